@@ -1,24 +1,5 @@
-#include <fstream>
-#include "ticpp/expr.hpp"
-#include "ticpp/stmt.hpp"
-#include "ticpp/codegen.hpp"
-
-namespace ticpp {
-
-
-
-
-
-} // namespace ticpp
-
-void kernel_impl(ticpp::IntValue i, ticpp::FloatValue f, ticpp::NdArrayValue ndarray) {
-  TICPP_FOR(idxs, ndarray) {
-    ndarray[idxs] = ticpp::VectorValue({
-      ticpp::to_float(idxs[0]),
-      ticpp::to_float(idxs[1]) + f
-    });
-  };
-}
+#include <filesystem>
+#include "kernels/demo.hpp"
 
 int main(int argc, const char** argv) {
   ti::Runtime runtime(TI_ARCH_VULKAN);
@@ -26,6 +7,10 @@ int main(int argc, const char** argv) {
   ti::NdArray<float> arr = runtime.allocate_ndarray<float>({4, 8}, {2}, true);
 
   auto x = ticpp::to_kernel(runtime, kernel_impl);
+  // Use the module prebuilt by `ticpp_aot_bundle` if there is one.
+  if (std::filesystem::exists("module/metadata.tcb")) {
+    x.bind(ticpp::load_aot_bundle(runtime, "module"), "kernel_impl");
+  }
   x.launch(1, 1.23f, arr.ndarray());
 
   runtime.wait();
@@ -0,0 +1,317 @@
+// Benchmark suite covering tracing, codegen, compilation, module loading
+// and kernel launches. Results are written as JSON for regression tracking.
+//
+// Runs without a GPU either on the CPU backend (`--arch=x64`, requires a
+// Taichi C-API built with LLVM) or on a software Vulkan driver such as
+// lavapipe or SwiftShader selected with `VK_ICD_FILENAMES`.
+// @PENGUINLIONG
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+#include <fstream>
+#include "ticpp/aot_bundle.hpp"
+
+using namespace ticpp;
+
+struct BenchResult {
+  std::string name;
+  std::string param;
+  uint32_t niter;
+  double mean_ns;
+  double min_ns;
+  double max_ns;
+  // Zero if the benchmark doesn't measure throughput.
+  double bytes_per_iter;
+};
+
+struct BenchConfig {
+  TiArch arch = TI_ARCH_VULKAN;
+  std::string filter;
+  std::string json_path = "ticpp_bench.json";
+  // Iterations of the cheap benchmarks; compilation benchmarks run fewer.
+  uint32_t niter = 100;
+};
+
+struct BenchContext {
+  BenchConfig cfg;
+  ti::Runtime runtime;
+  std::vector<BenchResult> results;
+
+  bool is_enabled(const std::string& name) const {
+    return cfg.filter.empty() || name.find(cfg.filter) != std::string::npos;
+  }
+
+  // Time `f` `niter` times. `f` is responsible for synchronization if the
+  // work is asynchronous.
+  template<typename TFunc>
+  void measure(
+    const std::string& name,
+    const std::string& param,
+    uint32_t niter,
+    TFunc f,
+    double bytes_per_iter = 0.0
+  ) {
+    std::vector<double> times;
+    times.reserve(niter);
+    for (uint32_t i = 0; i < niter; ++i) {
+      auto beg = std::chrono::steady_clock::now();
+      f(i);
+      auto end = std::chrono::steady_clock::now();
+      times.emplace_back(std::chrono::duration<double, std::nano>(end - beg).count());
+    }
+
+    BenchResult res {};
+    res.name = name;
+    res.param = param;
+    res.niter = niter;
+    res.mean_ns = 0.0;
+    for (double t : times) {
+      res.mean_ns += t;
+    }
+    res.mean_ns /= std::max<uint32_t>(niter, 1);
+    res.min_ns = *std::min_element(times.begin(), times.end());
+    res.max_ns = *std::max_element(times.begin(), times.end());
+    res.bytes_per_iter = bytes_per_iter;
+
+    std::cerr << "[bench] " << name << "/" << param << ": " << res.mean_ns / 1000.0 << " us";
+    if (bytes_per_iter > 0.0) {
+      std::cerr << " (" << bytes_per_iter / res.mean_ns << " GB/s)";
+    }
+    std::cerr << std::endl;
+    results.emplace_back(std::move(res));
+  }
+};
+
+
+
+typedef std::function<void(NdArrayValue, NdArrayValue)> UnaryKernelFunc;
+typedef std::function<void(NdArrayValue, NdArrayValue, NdArrayValue)> BinaryKernelFunc;
+
+void add_kernel_impl(NdArrayValue dst, NdArrayValue a, NdArrayValue b) {
+  TICPP_FOR(idxs, dst) {
+    dst[idxs] = a[idxs].as_float() + b[idxs].as_float();
+  };
+}
+
+// 5-point stencil; `src` has a one-element border around `dst`.
+void stencil_kernel_impl(NdArrayValue dst, NdArrayValue src) {
+  TICPP_FOR(idxs, dst) {
+    IntValue i = idxs[0] + 1;
+    IntValue j = idxs[1] + 1;
+    dst[idxs] = src[{ i, j }].as_float() +
+      src[{ i - 1, j }].as_float() +
+      src[{ i + 1, j }].as_float() +
+      src[{ i, j - 1 }].as_float() +
+      src[{ i, j + 1 }].as_float();
+  };
+}
+
+
+
+void bench_expr_tree(BenchContext& ctx) {
+  if (!ctx.is_enabled("expr_tree")) { return; }
+
+  for (uint32_t n : { 64u, 1024u, 16384u }) {
+    ctx.measure("expr_tree", "nodes=" + std::to_string(n), ctx.cfg.niter, [&](uint32_t) {
+      PARSE_CONTEXT.start();
+      FloatValue x = expr_conv_t<float>::to_expr(1.0f);
+      for (uint32_t i = 0; i < n; ++i) {
+        x = x + FloatValue(1.0f);
+      }
+      PARSE_CONTEXT.stop();
+    });
+  }
+}
+
+void bench_codegen(BenchContext& ctx) {
+  if (!ctx.is_enabled("codegen")) { return; }
+
+  for (uint32_t n : { 16u, 256u, 4096u }) {
+    // A kernel with `n` stores to distinct rows of `dst` in its loop body, so
+    // dead store elimination can't remove any of them.
+    UnaryKernelFunc fn = [n](NdArrayValue dst, NdArrayValue src) {
+      TICPP_FOR(idxs, src) {
+        for (uint32_t i = 0; i < n; ++i) {
+          dst[{ IntValue((int32_t)i), idxs[0] }] = src[idxs].as_float() + FloatValue((float)i);
+        }
+      };
+    };
+    auto trace = [&]() {
+      return run_trace(fn,
+        ndarray_sig(TI_DATA_TYPE_F32, { n, 64 }, {}),
+        ndarray_sig(TI_DATA_TYPE_F32, { 64 }, {}));
+    };
+    ParseResult itm = trace();
+
+    ctx.measure("composite_python_script", "stmts=" + std::to_string(n), ctx.cfg.niter, [&](uint32_t) {
+      composite_python_script(ctx.cfg.arch, itm);
+    });
+
+    // Passes rewrite the IR in place, so each iteration gets its own trace,
+    // made before timing.
+    std::vector<ParseResult> itms;
+    for (uint32_t i = 0; i < ctx.cfg.niter; ++i) {
+      itms.emplace_back(trace());
+    }
+    ctx.measure("pass_manager", "stmts=" + std::to_string(n), ctx.cfg.niter, [&](uint32_t i) {
+      PassManager::create_default().run(itms.at(i));
+    });
+  }
+}
+
+void bench_instantiate(BenchContext& ctx) {
+  if (!ctx.is_enabled("instantiate")) { return; }
+
+  ti::NdArray<float> dst = ctx.runtime.allocate_ndarray<float>({ 64, 64 }, {}, false);
+  ti::NdArray<float> src = ctx.runtime.allocate_ndarray<float>({ 64, 64 }, {}, false);
+
+  // Every iteration generates a different script so nothing is cached. This
+  // includes running Python and loading the module.
+  uint32_t ncold = std::max<uint32_t>(ctx.cfg.niter / 20, 3);
+  ctx.measure("instantiate", "cached=0", ncold, [&](uint32_t i) {
+    UnaryKernelFunc fn = [i](NdArrayValue dst, NdArrayValue src) {
+      TICPP_FOR(idxs, dst) {
+        dst[idxs] = src[idxs].as_float() + FloatValue((float)i);
+      };
+    };
+    Kernel<UnaryKernelFunc> kernel(ctx.runtime, fn);
+    kernel.instantiate(dst.ndarray(), src.ndarray());
+  });
+
+  // Identical scripts hit the module cache; this measures tracing, codegen
+  // and graph lookup.
+  UnaryKernelFunc fn = [](NdArrayValue dst, NdArrayValue src) {
+    TICPP_FOR(idxs, dst) {
+      dst[idxs] = src[idxs].as_float() + FloatValue(1.0f);
+    };
+  };
+  Kernel<UnaryKernelFunc> warm(ctx.runtime, fn);
+  warm.instantiate(dst.ndarray(), src.ndarray());
+  ctx.measure("instantiate", "cached=1", ctx.cfg.niter, [&](uint32_t) {
+    Kernel<UnaryKernelFunc> kernel(ctx.runtime, fn);
+    kernel.instantiate(dst.ndarray(), src.ndarray());
+  });
+}
+
+void bench_launch(BenchContext& ctx) {
+  if (!ctx.is_enabled("launch")) { return; }
+
+  ti::NdArray<float> dst = ctx.runtime.allocate_ndarray<float>({ 1 }, {}, false);
+  ti::NdArray<float> src = ctx.runtime.allocate_ndarray<float>({ 1 }, {}, false);
+
+  UnaryKernelFunc fn = [](NdArrayValue dst, NdArrayValue src) {
+    TICPP_FOR(idxs, dst) {
+      dst[idxs] = src[idxs].as_float();
+    };
+  };
+  Kernel<UnaryKernelFunc> kernel(ctx.runtime, fn);
+  kernel.instantiate(dst.ndarray(), src.ndarray());
+
+  // Host-side cost of a launch, without waiting for the device.
+  ctx.measure("launch", "sync=0", ctx.cfg.niter * 10, [&](uint32_t) {
+    kernel.launch(dst.ndarray(), src.ndarray());
+  });
+  ctx.runtime.wait();
+
+  // Round trip of a trivial launch.
+  ctx.measure("launch", "sync=1", ctx.cfg.niter, [&](uint32_t) {
+    kernel.launch(dst.ndarray(), src.ndarray());
+    ctx.runtime.wait();
+  });
+}
+
+void bench_throughput(BenchContext& ctx) {
+  for (uint32_t n : { 256u, 1024u, 4096u }) {
+    std::string param = "n=" + std::to_string(n);
+
+    if (ctx.is_enabled("elementwise_add")) {
+      ti::NdArray<float> dst = ctx.runtime.allocate_ndarray<float>({ n, n }, {}, false);
+      ti::NdArray<float> a = ctx.runtime.allocate_ndarray<float>({ n, n }, {}, false);
+      ti::NdArray<float> b = ctx.runtime.allocate_ndarray<float>({ n, n }, {}, false);
+
+      Kernel<BinaryKernelFunc> kernel(ctx.runtime, add_kernel_impl);
+      kernel.launch(dst.ndarray(), a.ndarray(), b.ndarray());
+      ctx.runtime.wait();
+
+      ctx.measure("elementwise_add", param, ctx.cfg.niter, [&](uint32_t) {
+        kernel.launch(dst.ndarray(), a.ndarray(), b.ndarray());
+        ctx.runtime.wait();
+      }, 3.0 * n * n * sizeof(float));
+    }
+
+    if (ctx.is_enabled("stencil_5pt")) {
+      ti::NdArray<float> dst = ctx.runtime.allocate_ndarray<float>({ n, n }, {}, false);
+      ti::NdArray<float> src = ctx.runtime.allocate_ndarray<float>({ n + 2, n + 2 }, {}, false);
+
+      Kernel<UnaryKernelFunc> kernel(ctx.runtime, stencil_kernel_impl);
+      kernel.launch(dst.ndarray(), src.ndarray());
+      ctx.runtime.wait();
+
+      // Count each element once, assuming neighbors are served from cache.
+      ctx.measure("stencil_5pt", param, ctx.cfg.niter, [&](uint32_t) {
+        kernel.launch(dst.ndarray(), src.ndarray());
+        ctx.runtime.wait();
+      }, 2.0 * n * n * sizeof(float));
+    }
+  }
+}
+
+
+
+void write_json(const BenchConfig& cfg, const std::vector<BenchResult>& results) {
+  std::fstream f(cfg.json_path, std::ios::out | std::ios::trunc);
+  f.precision(15);
+  f << "{" << std::endl;
+  f << "  \"arch\": \"" << (cfg.arch == TI_ARCH_X64 ? "x64" : "vulkan") << "\"," << std::endl;
+  f << "  \"benchmarks\": [" << std::endl;
+  for (size_t i = 0; i < results.size(); ++i) {
+    const BenchResult& res = results.at(i);
+    f << "    {"
+      << "\"name\": \"" << res.name << "\", "
+      << "\"param\": \"" << res.param << "\", "
+      << "\"iterations\": " << res.niter << ", "
+      << "\"mean_ns\": " << res.mean_ns << ", "
+      << "\"min_ns\": " << res.min_ns << ", "
+      << "\"max_ns\": " << res.max_ns;
+    if (res.bytes_per_iter > 0.0) {
+      f << ", \"bytes_per_second\": " << res.bytes_per_iter / res.mean_ns * 1e9;
+    }
+    f << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+  }
+  f << "  ]" << std::endl;
+  f << "}" << std::endl;
+}
+
+int main(int argc, const char** argv) {
+  BenchConfig cfg {};
+  for (int i = 1; i < argc; ++i) {
+    if (std::strcmp(argv[i], "--arch=vulkan") == 0) {
+      cfg.arch = TI_ARCH_VULKAN;
+    } else if (std::strcmp(argv[i], "--arch=x64") == 0) {
+      cfg.arch = TI_ARCH_X64;
+    } else if (std::strncmp(argv[i], "--filter=", 9) == 0) {
+      cfg.filter = argv[i] + 9;
+    } else if (std::strncmp(argv[i], "--json=", 7) == 0) {
+      cfg.json_path = argv[i] + 7;
+    } else if (std::strncmp(argv[i], "--iterations=", 13) == 0) {
+      cfg.niter = std::max(std::atoi(argv[i] + 13), 1);
+    } else {
+      std::cerr << "usage: " << argv[0]
+        << " [--arch=vulkan|x64] [--filter=<substr>] [--json=<path>] [--iterations=<n>]"
+        << std::endl;
+      return -1;
+    }
+  }
+
+  BenchContext ctx { cfg, ti::Runtime(cfg.arch), {} };
+
+  bench_expr_tree(ctx);
+  bench_codegen(ctx);
+  bench_instantiate(ctx);
+  bench_launch(ctx);
+  bench_throughput(ctx);
+
+  write_json(cfg, ctx.results);
+  std::cerr << "[bench] results written to " << cfg.json_path << std::endl;
+  return 0;
+}
@@ -0,0 +1,71 @@
+// Build-time AOT kernel bundling.
+// @PENGUINLIONG
+#pragma once
+#include "ticpp/codegen.hpp"
+
+namespace ticpp {
+
+// A kernel registered for build-time compilation. `trace` runs the kernel
+// function on the declared signature.
+struct RegisteredKernel {
+  std::string name;
+  std::function<ParseResult()> trace;
+};
+
+extern std::vector<RegisteredKernel>& get_registered_kernels();
+
+template<typename TFunc, typename ... TArgs>
+bool register_kernel(const std::string& name, TFunc fn, TArgs ... args) {
+  typename get_func_ty<TFunc>::type func { fn };
+  RegisteredKernel kernel {};
+  kernel.name = name;
+  kernel.trace = [func, args ...]() mutable {
+    return run_trace(func, args ...);
+  };
+  get_registered_kernels().emplace_back(std::move(kernel));
+  return true;
+}
+
+// Placeholder ndarray argument used to declare a kernel signature. The memory
+// handle is null; only the type and shape are used in tracing.
+inline TiNdArray ndarray_sig(
+  TiDataType elem_type,
+  const std::vector<uint32_t>& shape,
+  const std::vector<uint32_t>& elem_shape
+) {
+  TiNdArray out {};
+  out.elem_type = elem_type;
+  out.shape.dim_count = shape.size();
+  for (size_t i = 0; i < shape.size(); ++i) {
+    out.shape.dims[i] = shape.at(i);
+  }
+  out.elem_shape.dim_count = elem_shape.size();
+  for (size_t i = 0; i < elem_shape.size(); ++i) {
+    out.elem_shape.dims[i] = elem_shape.at(i);
+  }
+  return out;
+}
+
+// Register a kernel to be compiled into the AOT bundle by the
+// `ticpp_aot_bundle` build target. The trailing arguments are sample
+// arguments declaring the kernel signature, e.g.
+//
+//   TICPP_REGISTER_KERNEL(fill, fill_impl, 0, 1.0f,
+//     ticpp::ndarray_sig(TI_DATA_TYPE_F32, {4, 8}, {2}));
+//
+// At runtime bind a `Kernel` to the prebuilt graph with
+// `kernel.bind(load_aot_bundle(runtime, "module"), "fill")`.
+#define TICPP_REGISTER_KERNEL(name, fn, ...) \
+  static const bool TICPP_REGISTERED_KERNEL_##name = \
+    ::ticpp::register_kernel(#name, fn, __VA_ARGS__)
+
+// Trace all registered kernels and compile them into a single AOT module
+// saved to `module_dir`.
+extern void compile_aot_bundle(TiArch arch, const std::string& module_dir);
+// Load a module compiled by `compile_aot_bundle`. No Python is involved.
+extern std::shared_ptr<ti::AotModule> load_aot_bundle(
+  ti::Runtime& runtime,
+  const std::string& module_dir
+);
+
+} // namespace ticpp
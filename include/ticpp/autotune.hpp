@@ -0,0 +1,42 @@
+// Empirical selection of kernel configurations.
+//
+// `Kernel::autotune` compiles a variant per candidate configuration, times
+// each on representative arguments and keeps the fastest. Winners are
+// persisted by kernel, arch and device so later runs skip tuning.
+//
+// @PENGUINLIONG
+#pragma once
+#include "ticpp/pass.hpp"
+
+namespace ticpp {
+
+struct AutotuneConfig {
+  // Candidate block dims of kernel-level loops; 0 leaves it to Taichi.
+  std::vector<uint32_t> block_dims = { 0, 32, 64, 128, 256 };
+  // Also try each block dim with shape specialization.
+  bool try_specialize_shapes = true;
+  uint32_t nwarmup = 2;
+  uint32_t nrepeat = 10;
+};
+
+// Vulkan devices are named by their properties. The `TICPP_DEVICE_NAME`
+// environment variable overrides the name, and is required to tell devices
+// of other archs apart, which are otherwise named `default`.
+extern std::string get_autotune_device_name(TiArch arch, TiRuntime runtime);
+// Key of the tuned configuration of a traced kernel launched with the
+// ndarray shapes in `shape_key` on `runtime`.
+extern std::string make_autotune_key(
+  TiArch arch,
+  TiRuntime runtime,
+  const std::string& script,
+  const std::string& shape_key
+);
+
+// Tuned configurations are stored in `autotune.txt` under `TICPP_CACHE_DIR`,
+// or `.ticpp` in the working directory. Processes sharing the cache serialize
+// updates with `autotune.txt.lock`.
+extern std::string get_autotune_cache_path();
+extern bool load_tuned_config(const std::string& key, KernelConfig& cfg);
+extern void save_tuned_config(const std::string& key, const KernelConfig& cfg);
+
+} // namespace ticpp
@@ -1,25 +1,60 @@
 // Code generator.
 // @PENGUINLIONG
 #pragma once
-#include "ticpp/parse_context.hpp"
+#include <algorithm>
+#include <chrono>
+#include <map>
+#include <typeinfo>
+#include "ticpp/autotune.hpp"
+#include "ticpp/event.hpp"
+#include "ticpp/field.hpp"
+#include "ticpp/layout.hpp"
+#include "ticpp/pass.hpp"
 
 namespace ticpp {
 
+extern const char* arch2str(TiArch arch);
+
 extern std::string composite_python_script(
   TiArch arch,
   const ParseResult& itm
 );
+// Print a generated script. Only prints if the `TICPP_PRINT_SCRIPT`
+// environment variable is set to anything other than `0`.
+extern void print_script(const std::string& script);
+// Compile multiple traced kernels into a single module. Each kernel is added
+// as a compute graph named after the first element of the pair.
+extern std::string composite_python_bundle_script(
+  TiArch arch,
+  const std::vector<std::pair<std::string, ParseResult>>& itms
+);
 
 
 
 template<typename TFunc, typename ... TArgs>
-std::string run_codegen(TiArch arch, TFunc& fn, TArgs ... args) {
+ParseResult run_trace(TFunc& fn, TArgs ... args) {
   PARSE_CONTEXT.start();
-  fn(expr_conv_t<TArgs>::to_expr(args) ...);
-  ParseResult itm = PARSE_CONTEXT.stop();
+  // Elements of a braced initializer are evaluated in order, so arguments are
+  // registered in the same order `assign_cgraph_args_t` assigns them.
+  std::tuple<decltype(expr_conv_t<TArgs>::to_expr(args)) ...> values {
+    expr_conv_t<TArgs>::to_expr(args) ...
+  };
+  std::apply(fn, std::move(values));
+  return PARSE_CONTEXT.stop();
+}
+
+template<typename TFunc, typename ... TArgs>
+std::string run_codegen(TiArch arch, const KernelConfig& cfg, TFunc& fn, TArgs ... args) {
+  ParseResult itm = run_trace(fn, args ...);
+  if (!itm.fields.empty()) {
+    throw std::runtime_error("kernel uses field " + itm.fields.front()->name +
+      ", compile it in a `KernelBundle` or with `TICPP_REGISTER_KERNEL` so that "
+      "kernels share its storage");
+  }
+  print_pass_stats(PassManager::create_default(cfg).run(itm));
 
   std::string out = composite_python_script(arch, itm);
-  std::cout << out << std::endl;
+  print_script(out);
   return out;
 }
 
@@ -35,13 +70,39 @@ struct assign_cgraph_args_t<TFirst> {
   static void assign(ti::ComputeGraph& cgraph, uint32_t counter, const float& x) {
     cgraph["_" + std::to_string(counter)] = x;
   }
+  static void assign(ti::ComputeGraph& cgraph, uint32_t counter, const int16_t& x) {
+    assign_scalar(cgraph, counter, x);
+  }
+  static void assign(ti::ComputeGraph& cgraph, uint32_t counter, const uint8_t& x) {
+    assign_scalar(cgraph, counter, x);
+  }
+  static void assign(ti::ComputeGraph& cgraph, uint32_t counter, const f16_t& x) {
+    assign_scalar(cgraph, counter, x);
+  }
+  static void assign(ti::ComputeGraph& cgraph, uint32_t counter, const int64_t& x) {
+    assign_scalar(cgraph, counter, x);
+  }
+  static void assign(ti::ComputeGraph& cgraph, uint32_t counter, const double& x) {
+    assign_scalar(cgraph, counter, x);
+  }
   static void assign(ti::ComputeGraph& cgraph, uint32_t counter, const TiNdArray& x) {
     cgraph["_" + std::to_string(counter)] = x;
   }
+  static void assign(ti::ComputeGraph& cgraph, uint32_t counter, const SoaNdArray& x) {
+    cgraph["_" + std::to_string(counter)] = x.ndarray;
+  }
   template<typename U>
   static void assign(ti::ComputeGraph& cgraph, uint32_t counter, const ti::NdArray<U>& x) {
     cgraph["_" + std::to_string(counter)] = x.ndarray();
   }
+
+  // Passed as `TiScalar`.
+  template<typename U>
+  static void assign_scalar(ti::ComputeGraph& cgraph, uint32_t counter, const U& x) {
+    TiArgument arg {};
+    arg_conv_t<U>::to_ti_arg(arg, x);
+    cgraph["_" + std::to_string(counter)] = arg;
+  }
 };
 template<typename TFirst, typename ... TArgs>
 struct assign_cgraph_args_t<TFirst, TArgs ...> {
@@ -53,9 +114,93 @@ struct assign_cgraph_args_t<TFirst, TArgs ...> {
 
 
 
-extern void dump_aot_script(const std::string& script);
-extern std::string load_aot_module_path();
-extern void remove_aot_artifact(const std::string& temp_dir);
+extern std::string make_aot_scratch_dir();
+extern void dump_aot_script(const std::string& scratch_dir, const std::string& script);
+extern std::string load_aot_module_path(const std::string& scratch_dir);
+extern void remove_aot_artifact(const std::string& scratch_dir);
+
+// Compile `script` into an AOT module loaded on `runtime`. Safe to call from
+// multiple threads; concurrent requests for the same script on the same
+// runtime are compiled only once and the module is shared.
+extern std::shared_ptr<ti::AotModule> compile_aot_module(
+  ti::Runtime& runtime,
+  const std::string& script
+);
+
+// Key of the ndarray shapes in an argument list.
+inline void append_shape_key(std::stringstream& ss, const TiNdArray& x) {
+  for (uint32_t i = 0; i < x.shape.dim_count; ++i) {
+    ss << x.shape.dims[i] << ",";
+  }
+  ss << ";";
+}
+template<typename U>
+inline void append_shape_key(std::stringstream& ss, const ti::NdArray<U>& x) {
+  append_shape_key(ss, x.ndarray());
+}
+inline void append_shape_key(std::stringstream& ss, const SoaNdArray& x) {
+  ss << "soa:";
+  append_shape_key(ss, x.ndarray);
+}
+template<typename T>
+inline void append_shape_key(std::stringstream& ss, const T& x) {
+  ss << ";";
+}
+template<typename ... TArgs>
+std::string shape_key(const TArgs& ... args) {
+  std::stringstream ss;
+  int dummy[] = { 0, (append_shape_key(ss, args), 0) ... };
+  (void)dummy;
+  return ss.str();
+}
+
+// Key of the argument types, and of ndarray shapes if `with_shapes`, that a
+// generated script depends on besides the kernel body.
+inline void append_signature_key(std::stringstream& ss, bool with_shapes, const TiNdArray& x) {
+  ss << "nd" << x.elem_type << "/" << x.shape.dim_count << "/";
+  for (uint32_t i = 0; i < x.elem_shape.dim_count; ++i) {
+    ss << x.elem_shape.dims[i] << ",";
+  }
+  ss << "/";
+  if (with_shapes) {
+    append_shape_key(ss, x);
+  } else {
+    ss << ";";
+  }
+}
+inline void append_signature_key(std::stringstream& ss, bool with_shapes, const SoaNdArray& x) {
+  ss << "soa";
+  append_signature_key(ss, with_shapes, x.ndarray);
+}
+template<typename U>
+inline void append_signature_key(std::stringstream& ss, bool with_shapes, const ti::NdArray<U>& x) {
+  append_signature_key(ss, with_shapes, x.ndarray());
+}
+template<typename T>
+inline void append_signature_key(std::stringstream& ss, bool with_shapes, const T& x) {
+  ss << typeid(T).name() << ";";
+}
+template<typename ... TArgs>
+std::string signature_key(bool with_shapes, const TArgs& ... args) {
+  std::stringstream ss;
+  int dummy[] = { 0, (append_signature_key(ss, with_shapes, args), 0) ... };
+  (void)dummy;
+  return ss.str();
+}
+
+// Modules of kernels whose body is known statically, e.g., `ct` kernels,
+// keyed by runtime and a key derived from the body's `constexpr` hash. A hit
+// skips tracing and codegen entirely.
+extern std::shared_ptr<ti::AotModule> get_or_compile_static_module(
+  ti::Runtime& runtime,
+  const std::string& key,
+  const std::function<std::shared_ptr<ti::AotModule>()>& compile
+);
+
+struct KernelVariant {
+  std::shared_ptr<ti::AotModule> mod;
+  ti::ComputeGraph cgraph;
+};
 
 template<typename TFunc>
 struct Kernel {};
@@ -63,42 +208,207 @@ template<typename ... TValues>
 struct Kernel<std::function<void(TValues ...)>> {
   ti::Runtime runtime_;
   std::function<void(TValues ...)> fn_;
+  KernelConfig config_;
 
-  // Ready after instantiation.
-  ti::AotModule mod_;
+  // Shape-generic kernel, ready after instantiation.
+  std::shared_ptr<ti::AotModule> mod_;
   ti::ComputeGraph cgraph_;
+  // Shape-specialized variants keyed by `shape_key`.
+  std::map<std::string, KernelVariant> specialized_;
+  // Set on the first asynchronous launch.
+  TimelineRef timeline_;
+  // Identity of a statically known kernel body; see
+  // `get_or_compile_static_module`. Empty for traced kernels.
+  std::string static_key_;
+
+  Kernel(
+    const ti::Runtime& runtime,
+    std::function<void(TValues ...)> fn,
+    const KernelConfig& config = {}
+  ) :
+    runtime_(runtime.arch(), runtime.runtime(), false),
+    fn_(std::move(fn)),
+    config_(config) {}
 
-  Kernel(const ti::Runtime& runtime, std::function<void(TValues ...)> fn) :
-    runtime_(runtime.arch(), runtime.runtime(), false), fn_(std::move(fn)) {}
+  template<typename ... TArgs>
+  KernelVariant compile_variant(const KernelConfig& cfg, const TArgs& ... args) {
+    static_assert(sizeof...(TArgs) == sizeof...(TValues), "");
+
+    // Run codegen, then compile the script or reuse the module another kernel
+    // has compiled.
+    auto compile = [&]() {
+      std::string script = run_codegen(runtime_.arch(), cfg, fn_, args ...);
+      return compile_aot_module(runtime_, script);
+    };
+
+    KernelVariant out {};
+    if (static_key_.empty()) {
+      out.mod = compile();
+    } else {
+      std::stringstream key;
+      key << static_key_ << "|" << cfg.specialize_shapes << "," << cfg.block_dim << "|"
+        << signature_key(cfg.specialize_shapes, args ...);
+      out.mod = get_or_compile_static_module(runtime_, key.str(), compile);
+    }
+
+    // Load compute graph. Each kernel owns its graph so that arguments
+    // assigned by concurrent launches don't interfere.
+    out.cgraph = out.mod->get_compute_graph("g");
+    return out;
+  }
 
   template<typename ... TArgs>
   void instantiate(const TArgs& ... args) {
-    if (mod_.is_valid()) { return; }
+    if (mod_ != nullptr) { return; }
 
-    static_assert(sizeof...(TArgs) == sizeof...(TValues), "");
+    KernelConfig cfg = config_;
+    cfg.specialize_shapes = false;
+    KernelVariant variant = compile_variant(cfg, args ...);
+    mod_ = std::move(variant.mod);
+    cgraph_ = std::move(variant.cgraph);
+  }
 
-    // Run codegen.
-    std::string script = run_codegen(runtime_.arch(), fn_, args ...);
+  // Bind to a graph in a prebuilt module, e.g. one loaded by
+  // `load_aot_bundle`. The kernel never traces or compiles afterwards.
+  void bind(const std::shared_ptr<ti::AotModule>& mod, const std::string& name) {
+    mod_ = mod;
+    cgraph_ = mod_->get_compute_graph(name);
+    config_.specialize_shapes = false;
+  }
 
-    // Dump and run the AOT script.
-    dump_aot_script(script);
+  // Get the compute graph to launch with `args`, compiling it if necessary.
+  template<typename ... TArgs>
+  ti::ComputeGraph& select_cgraph(const TArgs& ... args) {
+    if (config_.specialize_shapes) {
+      std::string key = shape_key(args ...);
+      auto it = specialized_.find(key);
+      if (it != specialized_.end()) {
+        return it->second.cgraph;
+      }
+      if (specialized_.size() < config_.max_shape_variants) {
+        KernelVariant variant = compile_variant(config_, args ...);
+        return specialized_.emplace(key, std::move(variant)).first->second.cgraph;
+      }
+    }
+    instantiate(args ...);
+    return cgraph_;
+  }
 
-    std::string path = load_aot_module_path();
-    std::cout << path << std::endl;
+  // Compile a variant per configuration candidate in `tune_cfg`, time each on
+  // `args` and launch with the fastest from now on. `args` should be
+  // representative of later launches; their ndarrays are written by the
+  // timed launches. The winner is persisted and reused by later runs on the
+  // same device without re-tuning.
+  template<typename ... TArgs>
+  KernelConfig autotune(const AutotuneConfig& tune_cfg, const TArgs& ... args) {
+    static_assert(sizeof...(TArgs) == sizeof...(TValues), "");
 
-    // Load compute graph.
-    mod_ = runtime_.load_aot_module(path);
-    cgraph_ = mod_.get_compute_graph("g");
+    KernelConfig base_cfg = config_;
+    base_cfg.specialize_shapes = false;
+    base_cfg.block_dim = 0;
+
+    // Key by the traced kernel before any configuration is applied.
+    std::string key = make_autotune_key(runtime_.arch(), runtime_.runtime(),
+      composite_python_script(runtime_.arch(), run_trace(fn_, args ...)),
+      shape_key(args ...));
+
+    KernelConfig best_cfg = base_cfg;
+    if (load_tuned_config(key, best_cfg)) {
+      std::cout << "[ticpp] autotune: loaded " << key << std::endl;
+      reset_config(best_cfg);
+      return best_cfg;
+    }
+
+    std::vector<KernelConfig> candidates;
+    for (uint32_t block_dim : tune_cfg.block_dims) {
+      KernelConfig cfg = base_cfg;
+      cfg.block_dim = block_dim;
+      candidates.emplace_back(cfg);
+      if (tune_cfg.try_specialize_shapes) {
+        cfg.specialize_shapes = true;
+        candidates.emplace_back(cfg);
+      }
+    }
+    if (candidates.empty()) {
+      candidates.emplace_back(base_cfg);
+    }
+
+    KernelVariant best_variant {};
+    double best_time = std::numeric_limits<double>::infinity();
+    for (const KernelConfig& cfg : candidates) {
+      KernelVariant variant = compile_variant(cfg, args ...);
+
+      for (uint32_t i = 0; i < tune_cfg.nwarmup; ++i) {
+        assign_cgraph_args_t<TArgs ...>::assign(variant.cgraph, 0, args ...);
+        variant.cgraph.launch();
+      }
+      runtime_.wait();
+
+      auto beg = std::chrono::steady_clock::now();
+      for (uint32_t i = 0; i < tune_cfg.nrepeat; ++i) {
+        assign_cgraph_args_t<TArgs ...>::assign(variant.cgraph, 0, args ...);
+        variant.cgraph.launch();
+      }
+      runtime_.wait();
+      auto end = std::chrono::steady_clock::now();
+      double time = std::chrono::duration<double, std::nano>(end - beg).count() /
+        std::max(tune_cfg.nrepeat, 1u);
+
+      std::cout << "[ticpp] autotune: block_dim=" << cfg.block_dim
+        << " specialize_shapes=" << cfg.specialize_shapes
+        << " " << time << "ns" << std::endl;
+      if (time < best_time) {
+        best_time = time;
+        best_cfg = cfg;
+        best_variant = std::move(variant);
+      }
+    }
+
+    save_tuned_config(key, best_cfg);
+    reset_config(best_cfg);
+    if (best_cfg.specialize_shapes) {
+      specialized_.emplace(shape_key(args ...), std::move(best_variant));
+    } else {
+      mod_ = std::move(best_variant.mod);
+      cgraph_ = std::move(best_variant.cgraph);
+    }
+    return best_cfg;
+  }
 
-    remove_aot_artifact(path);
+  // Drop compiled variants and compile with `cfg` from now on.
+  void reset_config(const KernelConfig& cfg) {
+    config_ = cfg;
+    mod_ = nullptr;
+    cgraph_ = ti::ComputeGraph {};
+    specialized_.clear();
   }
 
   template<typename ... TArgs>
   void launch(const TArgs& ... args) {
-    instantiate(args ...);
+    ti::ComputeGraph& cgraph = select_cgraph(args ...);
+
+    assign_cgraph_args_t<TArgs ...>::assign(cgraph, 0, args ...);
+    cgraph.launch();
+  }
+
+  // Launch and return an event that completes with this launch.
+  template<typename ... TArgs>
+  LaunchEvent launch_async(const TArgs& ... args) {
+    return launch_after({}, args ...);
+  }
+  // Like `launch_async` but ordered after `deps`.
+  template<typename ... TArgs>
+  LaunchEvent launch_after(const std::vector<LaunchEvent>& deps, const TArgs& ... args) {
+    if (timeline_ == nullptr) {
+      timeline_ = get_timeline(runtime_.arch(), runtime_.runtime());
+    }
+    wait_events(timeline_, deps);
+    launch(args ...);
 
-    assign_cgraph_args_t<TArgs ...>::assign(cgraph_, 0, args ...);
-    cgraph_.launch();
+    LaunchEvent out {};
+    out.timeline_ = timeline_;
+    out.event_ = timeline_->signal();
+    return out;
   }
 
   template<typename ... TArgs>
@@ -122,9 +432,9 @@ struct get_func_ty<void(*)(TArgs ...)> {
 
 
 template<typename TFunc>
-auto to_kernel(ti::Runtime& runtime, TFunc f) {
+auto to_kernel(ti::Runtime& runtime, TFunc f, const KernelConfig& config = {}) {
   typename get_func_ty<TFunc>::type func { f };
-  return Kernel<typename get_func_ty<TFunc>::type>(runtime, std::move(func));
+  return Kernel<typename get_func_ty<TFunc>::type>(runtime, std::move(func), config);
 }
 
 
@@ -2,11 +2,15 @@
 // @PENGUINLIONG
 #pragma once
 #include <cassert>
+#include <cstring>
 #include <iostream>
+#include <limits>
 #include <sstream>
 #include <string>
 #include <vector>
 #include <functional>
+#include <memory>
+#include <tuple>
 #include <taichi/cpp/taichi.hpp>
 
 namespace ticpp {
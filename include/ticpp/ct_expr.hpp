@@ -0,0 +1,288 @@
+// Compile-time expression templates.
+//
+// An alternative front end where kernel structure is encoded in types. The
+// operator overloads below build empty tag types, so a kernel is fully known
+// at C++ compile time; its structural hash is a `constexpr` and launching it
+// never runs the kernel function. The expression tree is materialized into
+// the same IR the tracing front end produces only if no module has been
+// compiled for the same hash, argument signature and runtime.
+//
+//   namespace ct = ticpp::ct;
+//   constexpr ct::Arg<0> f;
+//   constexpr ct::Arg<1> arr;
+//   constexpr ct::IterVar<0> i;
+//   constexpr auto body = ct::for_each(arr, i,
+//     ct::store(arr[i], ct::to_f32(i[ct::imm<0>]) + f));
+//   static_assert(decltype(body)::hash != 0, "");
+//
+//   auto k = ct::to_kernel<float, TiNdArray>(runtime, body);
+//   k.launch(1.0f, ndarray);
+//
+// @PENGUINLIONG
+#pragma once
+#include <type_traits>
+#include "ticpp/codegen.hpp"
+
+namespace ticpp {
+namespace ct {
+
+// FNV-1a over 64-bit words.
+constexpr uint64_t HASH_SEED = 14695981039346656037ull;
+constexpr uint64_t hash_combine(uint64_t h, uint64_t x) {
+  return (h ^ x) * 1099511628211ull;
+}
+template<typename ... T>
+constexpr uint64_t hash_all(uint64_t h) {
+  uint64_t hashes[] = { h, T::hash ... };
+  uint64_t out = HASH_SEED;
+  for (uint64_t x : hashes) {
+    out = hash_combine(out, x);
+  }
+  return out;
+}
+
+enum NodeTag : uint64_t {
+  NODE_TAG_ARG = 1,
+  NODE_TAG_IMM,
+  NODE_TAG_ITERVAR,
+  NODE_TAG_COMPONENT,
+  NODE_TAG_ADD,
+  NODE_TAG_SUB,
+  NODE_TAG_CAST_I32,
+  NODE_TAG_CAST_F32,
+  NODE_TAG_VECTOR,
+  NODE_TAG_INDEX,
+  NODE_TAG_STORE,
+  NODE_TAG_FOR,
+};
+
+// State used to materialize a compile-time tree into runtime IR.
+struct TraceContext {
+  std::vector<ExprRef> args;
+  std::vector<ExprRef> itervars;
+};
+
+struct ExprNode {};
+struct StmtNode {};
+template<typename T>
+struct is_expr_node : std::is_base_of<ExprNode, T> {};
+template<typename T>
+struct is_stmt_node : std::is_base_of<StmtNode, T> {};
+
+
+
+template<int32_t V>
+struct Imm : public ExprNode {
+  static constexpr uint64_t hash = hash_combine(hash_combine(HASH_SEED, NODE_TAG_IMM), (uint32_t)V);
+  static ExprRef to_expr(TraceContext& ctx) {
+    return IntImmExpr::create(V);
+  }
+};
+template<int32_t V>
+constexpr Imm<V> imm {};
+
+template<typename T, int32_t K>
+struct Component : public ExprNode {
+  static constexpr uint64_t hash = hash_all<T>(hash_combine(hash_combine(HASH_SEED, NODE_TAG_COMPONENT), (uint32_t)K));
+  static ExprRef to_expr(TraceContext& ctx) {
+    return IndexExpr::create(T::to_expr(ctx), IntImmExpr::create(K));
+  }
+};
+
+// Iteration variable of the `L`-th enclosing `for_each` (0 is outermost).
+template<uint32_t L>
+struct IterVar : public ExprNode {
+  static constexpr uint64_t hash = hash_combine(hash_combine(HASH_SEED, NODE_TAG_ITERVAR), L);
+  static ExprRef to_expr(TraceContext& ctx) {
+    return ctx.itervars.at(L);
+  }
+
+  template<int32_t K>
+  constexpr Component<IterVar<L>, K> operator[](Imm<K>) const {
+    return {};
+  }
+};
+
+template<typename A, typename I>
+struct Index : public ExprNode {
+  static constexpr uint64_t hash = hash_all<A, I>(NODE_TAG_INDEX);
+  static ExprRef to_expr(TraceContext& ctx) {
+    return IndexExpr::create(A::to_expr(ctx), I::to_expr(ctx));
+  }
+};
+
+// The `I`-th kernel argument.
+template<uint32_t I>
+struct Arg : public ExprNode {
+  static constexpr uint64_t hash = hash_combine(hash_combine(HASH_SEED, NODE_TAG_ARG), I);
+  static ExprRef to_expr(TraceContext& ctx) {
+    return ctx.args.at(I);
+  }
+
+  template<typename TIndex, typename = std::enable_if_t<is_expr_node<TIndex>::value>>
+  constexpr Index<Arg<I>, TIndex> operator[](TIndex) const {
+    return {};
+  }
+};
+
+template<typename A, typename B>
+struct Add : public ExprNode {
+  static constexpr uint64_t hash = hash_all<A, B>(NODE_TAG_ADD);
+  static ExprRef to_expr(TraceContext& ctx) {
+    return AddExpr::create(A::to_expr(ctx), B::to_expr(ctx));
+  }
+};
+template<typename A, typename B>
+struct Sub : public ExprNode {
+  static constexpr uint64_t hash = hash_all<A, B>(NODE_TAG_SUB);
+  static ExprRef to_expr(TraceContext& ctx) {
+    return SubExpr::create(A::to_expr(ctx), B::to_expr(ctx));
+  }
+};
+template<typename A>
+struct CastI32 : public ExprNode {
+  static constexpr uint64_t hash = hash_all<A>(NODE_TAG_CAST_I32);
+  static ExprRef to_expr(TraceContext& ctx) {
+    return TypeCastExpr::create("ti.i32", A::to_expr(ctx));
+  }
+};
+template<typename A>
+struct CastF32 : public ExprNode {
+  static constexpr uint64_t hash = hash_all<A>(NODE_TAG_CAST_F32);
+  static ExprRef to_expr(TraceContext& ctx) {
+    return TypeCastExpr::create("ti.f32", A::to_expr(ctx));
+  }
+};
+template<typename ... TElems>
+struct Vector : public ExprNode {
+  static constexpr uint64_t hash = hash_all<TElems ...>(NODE_TAG_VECTOR);
+  static ExprRef to_expr(TraceContext& ctx) {
+    // Braced initialization keeps the elements in order.
+    return VectorExpr::create(std::vector<ExprRef> { TElems::to_expr(ctx) ... });
+  }
+};
+
+template<typename A, typename B, typename = std::enable_if_t<is_expr_node<A>::value && is_expr_node<B>::value>>
+constexpr Add<A, B> operator+(A, B) {
+  return {};
+}
+template<typename A, typename B, typename = std::enable_if_t<is_expr_node<A>::value && is_expr_node<B>::value>>
+constexpr Sub<A, B> operator-(A, B) {
+  return {};
+}
+template<typename A>
+constexpr CastI32<A> to_i32(A) {
+  return {};
+}
+template<typename A>
+constexpr CastF32<A> to_f32(A) {
+  return {};
+}
+template<typename ... TElems>
+constexpr Vector<TElems ...> vec(TElems ...) {
+  return {};
+}
+
+
+
+template<typename TDst, typename TValue>
+struct Store : public StmtNode {
+  static constexpr uint64_t hash = hash_all<TDst, TValue>(NODE_TAG_STORE);
+  static void emit(TraceContext& ctx) {
+    StoreStmt::create(TDst::to_expr(ctx), TValue::to_expr(ctx))->commit();
+  }
+};
+template<typename TRange, uint32_t L, typename ... TStmts>
+struct For : public StmtNode {
+  static constexpr uint64_t hash = hash_all<TRange, IterVar<L>, TStmts ...>(NODE_TAG_FOR);
+  static void emit(TraceContext& ctx) {
+    ExprRef range = TRange::to_expr(ctx);
+    ExprRef itervar = IterVarExpr::create(PARSE_CONTEXT.alloc_itervar_name());
+    if (ctx.itervars.size() <= L) {
+      ctx.itervars.resize(L + 1);
+    }
+    ctx.itervars.at(L) = itervar;
+
+    PARSE_CONTEXT.start();
+    int dummy[] = { 0, (TStmts::emit(ctx), 0) ... };
+    (void)dummy;
+    ParseResult res = PARSE_CONTEXT.stop();
+
+    ForStmt::create(std::move(itervar), std::move(range), std::move(res.stmts))->commit();
+  }
+};
+
+template<typename TDst, typename TValue>
+constexpr Store<TDst, TValue> store(TDst, TValue) {
+  static_assert(is_expr_node<TDst>::value && is_expr_node<TValue>::value, "");
+  return {};
+}
+template<typename TRange, uint32_t L, typename ... TStmts>
+constexpr For<TRange, L, TStmts ...> for_each(TRange, IterVar<L>, TStmts ...) {
+  static_assert(is_expr_node<TRange>::value, "");
+  static_assert(std::conjunction<is_stmt_node<TStmts> ...>::value, "");
+  return {};
+}
+
+
+
+// Compile-time tags of kernel argument types. Together with the body hash
+// they identify the generated kernel up to ndarray dtypes and shapes.
+template<typename T>
+struct arg_type_tag_t {};
+template<> struct arg_type_tag_t<int32_t> { static constexpr uint64_t value = 1; };
+template<> struct arg_type_tag_t<float> { static constexpr uint64_t value = 2; };
+template<> struct arg_type_tag_t<TiNdArray> { static constexpr uint64_t value = 3; };
+template<> struct arg_type_tag_t<SoaNdArray> { static constexpr uint64_t value = 4; };
+template<> struct arg_type_tag_t<int16_t> { static constexpr uint64_t value = 5; };
+template<> struct arg_type_tag_t<uint8_t> { static constexpr uint64_t value = 6; };
+template<> struct arg_type_tag_t<f16_t> { static constexpr uint64_t value = 7; };
+template<> struct arg_type_tag_t<int64_t> { static constexpr uint64_t value = 8; };
+template<> struct arg_type_tag_t<double> { static constexpr uint64_t value = 9; };
+
+template<typename TBody, typename ... TArgs>
+constexpr uint64_t kernel_hash() {
+  uint64_t tags[] = { TBody::hash, arg_type_tag_t<TArgs>::value ... };
+  uint64_t out = HASH_SEED;
+  for (uint64_t x : tags) {
+    out = hash_combine(out, x);
+  }
+  return out;
+}
+
+template<typename T>
+using value_t = decltype(expr_conv_t<T>::to_expr(std::declval<T>()));
+
+// Kernel built from a compile-time tree taking arguments of types `TArgs`. A
+// thin adapter over the tracing front end's `Kernel`, whose modules are
+// looked up by the `constexpr` hash before anything is materialized.
+template<typename TBody, typename ... TArgs>
+struct Kernel : public ticpp::Kernel<std::function<void(value_t<TArgs> ...)>> {
+  static constexpr uint64_t hash = kernel_hash<TBody, TArgs ...>();
+
+  Kernel(const ti::Runtime& runtime, const KernelConfig& config = {}) :
+    ticpp::Kernel<std::function<void(value_t<TArgs> ...)>>(runtime, &materialize, config)
+  {
+    std::stringstream ss;
+    ss << "ct:" << std::hex << hash;
+    this->static_key_ = ss.str();
+  }
+
+  // Arguments have been registered by `ticpp::run_trace`.
+  static void materialize(value_t<TArgs> ... values) {
+    TraceContext ctx {};
+    ctx.args = std::vector<ExprRef> { values.expr_ ... };
+    TBody::emit(ctx);
+  }
+};
+
+// Argument types are given explicitly, e.g.,
+// `ct::to_kernel<float, TiNdArray>(runtime, body)`.
+template<typename ... TArgs, typename TBody>
+Kernel<TBody, TArgs ...> to_kernel(ti::Runtime& runtime, TBody, const KernelConfig& config = {}) {
+  static_assert(is_stmt_node<TBody>::value, "kernel body must be a statement");
+  return Kernel<TBody, TArgs ...>(runtime, config);
+}
+
+} // namespace ct
+} // namespace ticpp
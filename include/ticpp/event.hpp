@@ -0,0 +1,130 @@
+// Per-launch completion events.
+// @PENGUINLIONG
+#pragma once
+#include <deque>
+#include <mutex>
+#include "ticpp/vulkan_interop.hpp"
+
+namespace ticpp {
+
+struct Timeline;
+typedef std::shared_ptr<Timeline> TimelineRef;
+
+// Device-side event signaled after a launch. The event is returned to the
+// timeline's pool when the last reference is dropped.
+struct DeviceEvent {
+  TiEvent event_;
+  // Sequence number of the launch that signaled the event.
+  uint64_t seq_;
+  // Latest launch that waits on the event on the device.
+  uint64_t last_use_;
+};
+typedef std::shared_ptr<DeviceEvent> DeviceEventRef;
+
+// Host-side record of the work submitted to a runtime. Submissions are
+// numbered in order; everything up to `nretire_` is known to be complete.
+//
+// Events are pooled and reset for reuse once they and every launch waiting
+// on them have retired. On Vulkan, launches retire as soon as their events
+// are observed signaled. Elsewhere the C-API can't query events on the host,
+// so launches only retire by `wait_all`.
+struct Timeline : public std::enable_shared_from_this<Timeline> {
+  TiArch arch_;
+  TiRuntime runtime_;
+  // Null if events can't be queried on the host.
+  VulkanEventQueryRef query_;
+  std::mutex mutex_;
+  uint64_t nsubmit_ = 0;
+  uint64_t nretire_ = 0;
+  // Events no longer referenced, in release order.
+  std::deque<DeviceEvent> pool_;
+
+  Timeline(TiArch arch, TiRuntime runtime);
+  Timeline(const Timeline&) = delete;
+  Timeline& operator=(const Timeline&) = delete;
+  ~Timeline();
+
+  // Make work submitted afterwards wait for `event` on the device.
+  void wait_on_device(const DeviceEventRef& event);
+  // Signal an event after pending work, flush to the device and return it.
+  DeviceEventRef signal();
+  // Block until `event` is signaled. Without host-side event queries this
+  // falls back to `wait_all`.
+  void wait(const DeviceEvent& event);
+  // Drain the runtime and retire everything submitted so far.
+  void wait_all();
+
+private:
+  // With `mutex_` held.
+  TiEvent acquire_event();
+  void poll_pool();
+  void release_event(DeviceEvent* event);
+};
+
+// Get the timeline shared by everyone using `runtime`.
+extern TimelineRef get_timeline(TiArch arch, TiRuntime runtime);
+
+// Completion of a launch. Launches are chained on the device; there is no
+// non-blocking completion query since the C-API can't answer one in general.
+struct LaunchEvent {
+  TimelineRef timeline_;
+  DeviceEventRef event_;
+
+  bool is_valid() const {
+    return timeline_ != nullptr;
+  }
+  // Block until the launch completes. On Vulkan this waits for this launch
+  // alone; elsewhere it drains the runtime.
+  void wait() const {
+    if (is_valid()) {
+      timeline_->wait(*event_);
+    }
+  }
+};
+
+// Make work submitted on `timeline` ordered after `deps`. Events of the same
+// runtime are waited on the device; events from other runtimes are waited on
+// the host.
+inline void wait_events(const TimelineRef& timeline, const std::vector<LaunchEvent>& deps) {
+  for (const LaunchEvent& dep : deps) {
+    if (!dep.is_valid()) { continue; }
+    if (dep.timeline_ == timeline) {
+      timeline->wait_on_device(dep.event_);
+    } else {
+      dep.wait();
+    }
+  }
+}
+
+// Copy `size` bytes from `src` to `dst` on the device after `deps`.
+extern LaunchEvent copy_memory_after(
+  const TimelineRef& timeline,
+  const std::vector<LaunchEvent>& deps,
+  TiMemory dst,
+  TiMemory src,
+  uint64_t size
+);
+
+// Copy `src` to `dst` on the device after `deps`, e.g., into a host-accessible
+// ndarray to read back, or from one written by the host. Wait for the
+// returned event before mapping `dst`.
+template<typename T>
+LaunchEvent copy_after(
+  const ti::Runtime& runtime,
+  const std::vector<LaunchEvent>& deps,
+  const ti::NdArray<T>& dst,
+  const ti::NdArray<T>& src
+) {
+  const TiNdArray& ndarray = src.ndarray();
+  uint64_t size = sizeof(T);
+  for (uint32_t i = 0; i < ndarray.shape.dim_count; ++i) {
+    size *= ndarray.shape.dims[i];
+  }
+  for (uint32_t i = 0; i < ndarray.elem_shape.dim_count; ++i) {
+    size *= ndarray.elem_shape.dims[i];
+  }
+  return copy_memory_after(get_timeline(runtime.arch(), runtime.runtime()),
+    deps, dst.ndarray().memory, ndarray.memory, size);
+}
+
+} // namespace ticpp
@@ -5,19 +5,33 @@
 
 namespace ticpp {
 
+struct Expr;
+typedef std::shared_ptr<Expr> ExprRef;
+typedef std::function<ExprRef(const ExprRef&)> ExprMapper;
+
 struct Expr {
   virtual ~Expr() {}
   virtual void to_string(PythonScriptWriter& ss) const = 0;
   virtual int32_t evaluate_i32() const {
     throw std::runtime_error("not a i32 expr");
   }
+  virtual float evaluate_f32() const {
+    throw std::runtime_error("not a f32 expr");
+  }
+
+  // Used by IR passes to walk and rewrite expression trees. Expressions can
+  // be shared so rewriting always makes a copy; leaf expressions have no
+  // children and return `nullptr` from `map_children`.
+  virtual void for_each_child(const std::function<void(const ExprRef&)>& f) const {}
+  virtual ExprRef map_children(const ExprMapper& f) const {
+    return nullptr;
+  }
 
   template<typename T>
   inline static std::shared_ptr<Expr> create(T&& x) {
     return std::shared_ptr<Expr>(static_cast<Expr*>(new T(std::move(x))));
   }
 };
-typedef std::shared_ptr<Expr> ExprRef;
 
 
 
@@ -40,7 +54,18 @@ struct AddExpr : public Expr {
     ss << ")";
   }
   virtual int32_t evaluate_i32() const override {
-    return a_->evaluate_i32() + b_->evaluate_i32();
+    // Wrap around on overflow like i32 in Taichi.
+    return (int32_t)((uint32_t)a_->evaluate_i32() + (uint32_t)b_->evaluate_i32());
+  }
+  virtual float evaluate_f32() const override {
+    return a_->evaluate_f32() + b_->evaluate_f32();
+  }
+  virtual void for_each_child(const std::function<void(const ExprRef&)>& f) const override {
+    f(a_);
+    f(b_);
+  }
+  virtual ExprRef map_children(const ExprMapper& f) const override {
+    return create(f(a_), f(b_));
   }
 };
 struct SubExpr : public Expr {
@@ -62,7 +87,18 @@ struct SubExpr : public Expr {
     ss << ")";
   }
   virtual int32_t evaluate_i32() const override {
-    return a_->evaluate_i32() - b_->evaluate_i32();
+    // Wrap around on overflow like i32 in Taichi.
+    return (int32_t)((uint32_t)a_->evaluate_i32() - (uint32_t)b_->evaluate_i32());
+  }
+  virtual float evaluate_f32() const override {
+    return a_->evaluate_f32() - b_->evaluate_f32();
+  }
+  virtual void for_each_child(const std::function<void(const ExprRef&)>& f) const override {
+    f(a_);
+    f(b_);
+  }
+  virtual ExprRef map_children(const ExprMapper& f) const override {
+    return create(f(a_), f(b_));
   }
 };
 
@@ -92,6 +128,9 @@ struct IntImmExpr : public Expr {
   virtual int32_t evaluate_i32() const override {
     return value_;
   }
+  virtual float evaluate_f32() const override {
+    return (float)value_;
+  }
 };
 
 struct FloatImmExpr : public Expr {
@@ -104,7 +143,7 @@ struct FloatImmExpr : public Expr {
     out.value_ = value;
     return Expr::create(std::move(out));
   }
-  inline static ExprRef create(int32_t value) {
+  inline static ExprRef create(float value) {
     FloatImmExpr out {};
     out.value_ = value;
     return Expr::create(std::move(out));
@@ -112,20 +151,32 @@ struct FloatImmExpr : public Expr {
 
   virtual void to_string(PythonScriptWriter& ss) const override {
     if (arg_name_.empty()) {
-      ss << value_;
+      // Keep full precision and make sure Python sees a float literal.
+      std::stringstream ss2;
+      ss2.precision(std::numeric_limits<float>::max_digits10);
+      ss2 << value_;
+      std::string literal = ss2.str();
+      if (literal.find_first_of(".en") == std::string::npos) {
+        literal += ".0";
+      }
+      ss << literal;
     } else {
       ss << arg_name_;
     }
   }
+  virtual float evaluate_f32() const override {
+    return value_;
+  }
 };
 
 struct IterVarExpr : public Expr {
   std::string name_;
 
-  inline static ExprRef create() {
-    static size_t id_counter_ = 0;
+  // Names are allocated by the parse context so that they are unique within
+  // a trace and the same kernel always gets the same script.
+  inline static ExprRef create(const std::string& name) {
     IterVarExpr out {};
-    out.name_ = "it_" + std::to_string(id_counter_++);
+    out.name_ = name;
     return Expr::create(std::move(out));
   }
 
@@ -151,6 +202,13 @@ struct IndexExpr : public Expr {
     index_->to_string(ss);
     ss << "]";
   }
+  virtual void for_each_child(const std::function<void(const ExprRef&)>& f) const override {
+    f(alloc_);
+    f(index_);
+  }
+  virtual ExprRef map_children(const ExprMapper& f) const override {
+    return create(f(alloc_), f(index_));
+  }
 };
 
 struct VectorExpr : public Expr {
@@ -173,16 +231,44 @@ struct VectorExpr : public Expr {
       }
     }
   }
+  virtual void for_each_child(const std::function<void(const ExprRef&)>& f) const override {
+    for (const auto& elem : elems_) {
+      f(elem);
+    }
+  }
+  virtual ExprRef map_children(const ExprMapper& f) const override {
+    std::vector<ExprRef> elems;
+    for (const auto& elem : elems_) {
+      elems.emplace_back(f(elem));
+    }
+    return create(std::move(elems));
+  }
+};
+
+// Memory layout of vector ndarray elements.
+enum NdArrayLayout {
+  // Components of each element are interleaved, i.e., Taichi's vector
+  // ndarrays.
+  NDARRAY_LAYOUT_AOS,
+  // Each component is a contiguous plane of a scalar ndarray whose outermost
+  // dimension is the component index. Lowered by `SoaLoweringPass`.
+  NDARRAY_LAYOUT_SOA,
 };
 
 struct NdArrayAllocExpr : public Expr {
   std::string arg_name_;
   TiNdArray ndarray_;
+  NdArrayLayout layout_;
 
-  inline static ExprRef create(const std::string& arg_name, const TiNdArray& ndarray) {
+  inline static ExprRef create(
+    const std::string& arg_name,
+    const TiNdArray& ndarray,
+    NdArrayLayout layout = NDARRAY_LAYOUT_AOS
+  ) {
     NdArrayAllocExpr out {};
     out.arg_name_ = arg_name;
     out.ndarray_ = ndarray;
+    out.layout_ = layout;
     return Expr::create(std::move(out));
   }
 
@@ -191,6 +277,24 @@ struct NdArrayAllocExpr : public Expr {
   }
 };
 
+// Extent of an ndarray argument along `axis`, `arr.shape[axis]`.
+struct NdArrayShapeExpr : public Expr {
+  ExprRef alloc_;
+  uint32_t axis_;
+
+  inline static ExprRef create(const ExprRef& alloc, uint32_t axis) {
+    NdArrayShapeExpr out {};
+    out.alloc_ = alloc;
+    out.axis_ = axis;
+    return Expr::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    alloc_->to_string(ss);
+    ss << ".shape[" << axis_ << "]";
+  }
+};
+
 struct TypeCastExpr : public Expr {
   std::string target_ty_;
   ExprRef expr_;
@@ -206,6 +310,85 @@ struct TypeCastExpr : public Expr {
     expr_->to_string(ss);
     ss << ")";
   }
+  virtual void for_each_child(const std::function<void(const ExprRef&)>& f) const override {
+    f(expr_);
+  }
+  virtual ExprRef map_children(const ExprMapper& f) const override {
+    return create(target_ty_, f(expr_));
+  }
+};
+
+// A Taichi vector `ti.Vector([...])` of the elements of a `VectorExpr`.
+struct TiVectorExpr : public Expr {
+  ExprRef elems_;
+
+  inline static ExprRef create(const ExprRef& elems) {
+    TiVectorExpr out {};
+    out.elems_ = elems;
+    return Expr::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    ss << "ti.Vector([";
+    elems_->to_string(ss);
+    ss << "])";
+  }
+  virtual void for_each_child(const std::function<void(const ExprRef&)>& f) const override {
+    f(elems_);
+  }
+  virtual ExprRef map_children(const ExprMapper& f) const override {
+    return create(f(elems_));
+  }
+};
+
+// A multi-dimensional range `ti.ndrange(...)`.
+struct NdRangeExpr : public Expr {
+  std::vector<ExprRef> extents_;
+
+  inline static ExprRef create(std::vector<ExprRef>&& extents) {
+    NdRangeExpr out {};
+    out.extents_ = std::move(extents);
+    return Expr::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    ss << "ti.ndrange(";
+    for (const auto& extent : extents_) {
+      extent->to_string(ss);
+      ss << ", ";
+    }
+    ss << ")";
+  }
+  virtual void for_each_child(const std::function<void(const ExprRef&)>& f) const override {
+    for (const auto& extent : extents_) {
+      f(extent);
+    }
+  }
+  virtual ExprRef map_children(const ExprMapper& f) const override {
+    std::vector<ExprRef> extents;
+    for (const auto& extent : extents_) {
+      extents.emplace_back(f(extent));
+    }
+    return create(std::move(extents));
+  }
+};
+
+// A kernel-local variable declared by `DeclareStmt`. Mutable variables can
+// be reassigned by `AssignStmt` and are never treated as loop-invariant.
+struct LocalVarExpr : public Expr {
+  std::string name_;
+  bool is_mutable_;
+
+  inline static ExprRef create(const std::string& name, bool is_mutable = false) {
+    LocalVarExpr out {};
+    out.name_ = name;
+    out.is_mutable_ = is_mutable;
+    return Expr::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    ss << name_;
+  }
 };
 
 } // namespace ticpp
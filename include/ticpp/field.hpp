@@ -0,0 +1,258 @@
+// SNode-backed global fields.
+// @PENGUINLIONG
+#pragma once
+#include <atomic>
+#include "ticpp/parse_context.hpp"
+
+namespace ticpp {
+
+enum SNodeType {
+  SNODE_TYPE_DENSE,
+  SNODE_TYPE_POINTER,
+  SNODE_TYPE_BITMASKED,
+  SNODE_TYPE_DYNAMIC,
+};
+
+// A level in the SNode tree, from the root down to the leaf. `axes` are the
+// field axes the level spans; `shape` is its extent along each of them.
+struct SNodeDesc {
+  SNodeType type;
+  std::vector<uint32_t> axes;
+  std::vector<uint32_t> shape;
+  // Only used by dynamic SNodes.
+  uint32_t chunk_size;
+
+  inline static SNodeDesc create(
+    SNodeType type,
+    const std::vector<uint32_t>& shape,
+    const std::vector<uint32_t>& axes
+  ) {
+    SNodeDesc out {};
+    out.type = type;
+    out.shape = shape;
+    out.axes = axes;
+    if (out.axes.empty()) {
+      for (uint32_t i = 0; i < shape.size(); ++i) {
+        out.axes.emplace_back(i);
+      }
+    }
+    assert(out.axes.size() == out.shape.size());
+    return out;
+  }
+  inline static SNodeDesc dense(const std::vector<uint32_t>& shape, const std::vector<uint32_t>& axes = {}) {
+    return create(SNODE_TYPE_DENSE, shape, axes);
+  }
+  inline static SNodeDesc pointer(const std::vector<uint32_t>& shape, const std::vector<uint32_t>& axes = {}) {
+    return create(SNODE_TYPE_POINTER, shape, axes);
+  }
+  inline static SNodeDesc bitmasked(const std::vector<uint32_t>& shape, const std::vector<uint32_t>& axes = {}) {
+    return create(SNODE_TYPE_BITMASKED, shape, axes);
+  }
+  inline static SNodeDesc dynamic(uint32_t axis, uint32_t size, uint32_t chunk_size) {
+    SNodeDesc out = create(SNODE_TYPE_DYNAMIC, { size }, { axis });
+    out.chunk_size = chunk_size;
+    return out;
+  }
+};
+
+struct FieldDecl {
+  std::string name;
+  TiDataType dtype;
+  // Empty for scalar fields; `{n}` for vector fields.
+  std::vector<uint32_t> elem_shape;
+  std::vector<SNodeDesc> snodes;
+
+  bool is_sparse() const {
+    for (const SNodeDesc& snode : snodes) {
+      if (snode.type != SNODE_TYPE_DENSE) { return true; }
+    }
+    return false;
+  }
+};
+
+struct FieldExpr : public Expr {
+  FieldDeclRef decl_;
+
+  inline static ExprRef create(const FieldDeclRef& decl) {
+    FieldExpr out {};
+    out.decl_ = decl;
+    return Expr::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    ss << decl_->name;
+  }
+};
+
+// SNode operation on a field, e.g., `ti.is_active(fld_0.parent(2), [i, j])`.
+// `parent_` counts SNodes up from the field's place node. Like loads, these
+// read or write sparse structure and are never moved by passes.
+struct SNodeOpExpr : public Expr {
+  // `ti.is_active`, `ti.deactivate`, `ti.append` or `ti.length`.
+  std::string op_;
+  FieldDeclRef decl_;
+  uint32_t parent_;
+  ExprRef index_;
+  // Only used by `ti.append`.
+  ExprRef value_;
+
+  inline static ExprRef create(
+    const std::string& op,
+    const FieldDeclRef& decl,
+    uint32_t parent,
+    const ExprRef& index,
+    const ExprRef& value = nullptr
+  ) {
+    SNodeOpExpr out {};
+    out.op_ = op;
+    out.decl_ = decl;
+    out.parent_ = parent;
+    out.index_ = index;
+    out.value_ = value;
+    return Expr::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    ss << op_ << "(" << decl_->name << ".parent(" << parent_ << "), ";
+    // Grouped loop indices are passed as is.
+    if (dynamic_cast<const VectorExpr*>(index_.get()) != nullptr) {
+      ss << "[";
+      index_->to_string(ss);
+      ss << "]";
+    } else {
+      index_->to_string(ss);
+    }
+    if (value_ != nullptr) {
+      ss << ", ";
+      value_->to_string(ss);
+    }
+    ss << ")";
+  }
+  virtual void for_each_child(const std::function<void(const ExprRef&)>& f) const override {
+    f(index_);
+    if (value_ != nullptr) {
+      f(value_);
+    }
+  }
+  virtual ExprRef map_children(const ExprMapper& f) const override {
+    return create(op_, decl_, parent_, f(index_), value_ != nullptr ? f(value_) : nullptr);
+  }
+};
+
+// Extent of the field along each axis.
+inline std::vector<uint32_t> field_shape(const FieldDecl& decl) {
+  std::vector<uint32_t> out;
+  for (const SNodeDesc& snode : decl.snodes) {
+    for (size_t i = 0; i < snode.axes.size(); ++i) {
+      if (out.size() <= snode.axes.at(i)) {
+        out.resize(snode.axes.at(i) + 1, 1);
+      }
+      out.at(snode.axes.at(i)) *= snode.shape.at(i);
+    }
+  }
+  return out;
+}
+
+// Host-side handle of a field declared from C++.
+//
+// Field storage belongs to the AOT module a kernel is compiled into and is
+// released with it, so kernels using fields must be compiled together, with
+// `KernelBundle` at runtime or `TICPP_REGISTER_KERNEL` at build time.
+// Compiling them alone with `to_kernel` throws. `KernelBundle` also provides
+// host access.
+//
+// Sparse SNodes are only available on LLVM-based archs like x64; build the
+// Taichi C-API with `TICPP_WITH_LLVM=ON scripts/build-taichi-linux.sh`.
+struct Field {
+  FieldDeclRef decl_;
+};
+
+inline Field declare_field(
+  TiDataType dtype,
+  std::vector<SNodeDesc>&& snodes,
+  const std::vector<uint32_t>& elem_shape = {}
+) {
+  static std::atomic<uint32_t> counter_ { 0 };
+
+  FieldDeclRef decl = std::make_shared<FieldDecl>();
+  decl->name = "fld_" + std::to_string(counter_++);
+  decl->dtype = dtype;
+  decl->elem_shape = elem_shape;
+  decl->snodes = std::move(snodes);
+  return Field { std::move(decl) };
+}
+
+// Use a field in a kernel. Indexing, loads and stores work as for ndarrays;
+// `TICPP_FOR` over a field visits only the active cells.
+struct FieldValue : public NdArrayValue {
+  FieldValue(const Field& field) : NdArrayValue(FieldExpr::create(field.decl_)) {
+    PARSE_CONTEXT.reg_field(field.decl_);
+  }
+};
+
+// Index of a cell in SNode operations, in global field indices like loads
+// and stores.
+struct SNodeIndex {
+  ExprRef expr_;
+
+  SNodeIndex(const IterVarValue& itervar) : expr_(itervar.expr_) {}
+  SNodeIndex(const std::vector<IntValue>& idxs) {
+    std::vector<ExprRef> idxs2;
+    for (const IntValue& idx : idxs) {
+      idxs2.emplace_back(idx.expr_);
+    }
+    expr_ = VectorExpr::create(std::move(idxs2));
+  }
+  SNodeIndex(std::initializer_list<IntValue> idxs) :
+    SNodeIndex(std::vector<IntValue>(idxs)) {}
+};
+
+inline uint32_t snode_parent(const FieldDecl& decl, uint32_t level) {
+  if (level >= decl.snodes.size()) {
+    throw std::runtime_error("field " + decl.name + " has no snode level " + std::to_string(level));
+  }
+  return decl.snodes.size() - level;
+}
+inline uint32_t dynamic_snode_parent(const FieldDecl& decl) {
+  for (uint32_t i = 0; i < decl.snodes.size(); ++i) {
+    if (decl.snodes.at(i).type == SNODE_TYPE_DYNAMIC) {
+      return snode_parent(decl, i);
+    }
+  }
+  throw std::runtime_error("field " + decl.name + " has no dynamic snode");
+}
+
+// Whether the cell of SNode `level` (an index into `FieldDecl::snodes`)
+// containing `idx` is active.
+inline IntValue is_active(const Field& field, uint32_t level, const SNodeIndex& idx) {
+  PARSE_CONTEXT.reg_field(field.decl_);
+  uint32_t parent = snode_parent(*field.decl_, level);
+  return IntValue { SNodeOpExpr::create("ti.is_active", field.decl_, parent, idx.expr_) };
+}
+// Deactivate the cell of SNode `level` containing `idx`, and everything in it.
+inline void deactivate(const Field& field, uint32_t level, const SNodeIndex& idx) {
+  PARSE_CONTEXT.reg_field(field.decl_);
+  uint32_t parent = snode_parent(*field.decl_, level);
+  EvalStmt::create(SNodeOpExpr::create("ti.deactivate", field.decl_, parent, idx.expr_))->commit();
+}
+
+// Append `value` to the list of the dynamic SNode at `idx`, which excludes the
+// dynamic axis. Returns the list length before appending.
+template<typename TValue>
+inline IntValue append(const Field& field, const SNodeIndex& idx, const TValue& value) {
+  PARSE_CONTEXT.reg_field(field.decl_);
+  uint32_t parent = dynamic_snode_parent(*field.decl_);
+  ExprRef out = SNodeOpExpr::create("ti.append", field.decl_, parent, idx.expr_, value.expr_);
+  // Appends even if the result is unused.
+  ExprRef var = LocalVarExpr::create(PARSE_CONTEXT.alloc_local_name());
+  DeclareStmt::create(var, out)->commit();
+  return IntValue { std::move(var) };
+}
+// Length of the list of the dynamic SNode at `idx`.
+inline IntValue length(const Field& field, const SNodeIndex& idx) {
+  PARSE_CONTEXT.reg_field(field.decl_);
+  uint32_t parent = dynamic_snode_parent(*field.decl_);
+  return IntValue { SNodeOpExpr::create("ti.length", field.decl_, parent, idx.expr_) };
+}
+
+} // namespace ticpp
@@ -0,0 +1,74 @@
+// Kernels compiled together into one module at runtime.
+//
+// Global fields live in the module their kernels are compiled into, so
+// kernels sharing a field must be compiled together:
+//
+//   ticpp::Field fld = ticpp::declare_field(TI_DATA_TYPE_F32, {
+//     ticpp::SNodeDesc::pointer({ 8 }), ticpp::SNodeDesc::dense({ 16 }) });
+//   ticpp::KernelBundle bundle(runtime);
+//   bundle.add("activate", activate_impl, indices);
+//   bundle.add("process", process_impl, out);
+//   bundle.add_host_access(fld);
+//   bundle.build();
+//
+//   auto activate = bundle.kernel("activate", activate_impl);
+//   activate(indices);
+//   bundle.read_field(fld, host_ndarray);
+//
+// Field storage lives as long as the bundle or any kernel bound to it.
+//
+// @PENGUINLIONG
+#pragma once
+#include "ticpp/aot_bundle.hpp"
+
+namespace ticpp {
+
+struct KernelBundle {
+  ti::Runtime runtime_;
+  std::vector<RegisteredKernel> kernels_;
+  // Ready after `build`.
+  std::shared_ptr<ti::AotModule> mod_;
+
+  KernelBundle(const ti::Runtime& runtime) :
+    runtime_(runtime.arch(), runtime.runtime(), false) {}
+
+  // Add a kernel traced with sample arguments declaring its signature, like
+  // `TICPP_REGISTER_KERNEL`.
+  template<typename TFunc, typename ... TArgs>
+  void add(const std::string& name, TFunc fn, TArgs ... args) {
+    assert(mod_ == nullptr);
+    typename get_func_ty<TFunc>::type func { fn };
+    RegisteredKernel kernel {};
+    kernel.name = name;
+    kernel.trace = [func, args ...]() mutable {
+      return run_trace(func, args ...);
+    };
+    kernels_.emplace_back(std::move(kernel));
+  }
+  // Add kernels copying `field` from and to ndarrays of the field's dtype,
+  // shape and element shape; see `read_field` and `write_field`.
+  void add_host_access(const Field& field);
+
+  // Compile all kernels into one module.
+  void build();
+
+  // A kernel bound to the graph `name` in the module. It never traces or
+  // compiles.
+  template<typename TFunc>
+  auto kernel(const std::string& name, TFunc f) {
+    if (mod_ == nullptr) {
+      throw std::runtime_error("kernel bundle is not built");
+    }
+    auto out = to_kernel(runtime_, f);
+    out.bind(mod_, name);
+    return out;
+  }
+
+  // Copy the field to `dst`. Inactive cells of sparse fields read as zeros.
+  // Like other launches, wait for the runtime before mapping `dst`.
+  void read_field(const Field& field, const TiNdArray& dst);
+  // Copy `src` to the field. Every cell of a sparse field is activated.
+  void write_field(const Field& field, const TiNdArray& src);
+};
+
+} // namespace ticpp
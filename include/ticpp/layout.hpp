@@ -0,0 +1,65 @@
+// Structure-of-arrays (SoA) ndarray arguments.
+//
+// Vector ndarrays are stored interleaved (AoS) by Taichi. An ndarray argument
+// can instead be passed as a `SoaNdArray`, a scalar ndarray whose outermost
+// dimension is the component index, so that each component is a contiguous
+// plane. Kernels access it like an AoS ndarray:
+//
+//   void kernel_impl(ticpp::NdArrayValue arr) {
+//     TICPP_FOR(I, arr) {
+//       arr[I] = ticpp::VectorValue({ arr[I].component(1).as_float(), 0.0f });
+//     };
+//   }
+//   // A 2-component array of 4x8 elements.
+//   auto arr = runtime.allocate_ndarray<float>({2, 4, 8}, {});
+//   kernel(ticpp::SoaNdArray { arr.ndarray() });
+//
+// Loops iterate over the spatial dimensions and vector accesses are split
+// into per-component accesses by `SoaLoweringPass`. The component count is
+// taken from the traced shape.
+//
+// @PENGUINLIONG
+#pragma once
+#include "ticpp/parse_context.hpp"
+
+namespace ticpp {
+
+struct SoaNdArray {
+  TiNdArray ndarray;
+};
+
+template<>
+struct arg_conv_t<SoaNdArray> {
+  static inline void to_ti_arg(TiArgument& arg, const SoaNdArray& value) {
+    arg_conv_t<TiNdArray>::to_ti_arg(arg, value.ndarray);
+  }
+};
+template<>
+struct expr_conv_t<SoaNdArray> {
+  static inline NdArrayValue to_expr(const SoaNdArray& value) {
+    if (value.ndarray.elem_shape.dim_count != 0 || value.ndarray.shape.dim_count < 2) {
+      throw std::runtime_error("soa ndarray must be a scalar ndarray with a component dimension");
+    }
+    std::string name = "_" + std::to_string(PARSE_CONTEXT.reg_arg(value));
+    return NdArrayValue { NdArrayAllocExpr::create(name, value.ndarray, NDARRAY_LAYOUT_SOA) };
+  }
+};
+
+// Layout conversion kernels. `aos` is a vector ndarray and `soa` is the
+// `SoaNdArray` of the same elements, e.g.,
+//
+//   auto k = ticpp::to_kernel(runtime, ticpp::aos_to_soa);
+//   k(aos.ndarray(), ticpp::SoaNdArray { soa.ndarray() });
+//
+inline void aos_to_soa(NdArrayValue aos, NdArrayValue soa) {
+  TICPP_FOR(I, aos) {
+    soa[I] = aos[I].as_vector();
+  };
+}
+inline void soa_to_aos(NdArrayValue soa, NdArrayValue aos) {
+  TICPP_FOR(I, aos) {
+    aos[I] = soa[I].as_vector();
+  };
+}
+
+} // namespace ticpp
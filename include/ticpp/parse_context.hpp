@@ -5,6 +5,89 @@
 
 namespace ticpp {
 
+// Host-side half-precision float.
+struct f16_t {
+  uint16_t bits;
+
+  f16_t() : bits(0) {}
+  explicit f16_t(float value) : bits(float2half(value)) {}
+  explicit operator float() const {
+    return half2float(bits);
+  }
+
+  // Round to nearest even; overflow saturates to infinity.
+  static uint16_t float2half(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000;
+    int32_t exp = (int32_t)((x >> 23) & 0xff) - 127 + 15;
+    uint32_t mant = x & 0x7fffff;
+
+    if (((x >> 23) & 0xff) == 0xff) {
+      // Inf or NaN.
+      return sign | 0x7c00 | (mant != 0 ? 0x200 : 0);
+    } else if (exp >= 31) {
+      return sign | 0x7c00;
+    } else if (exp <= 0) {
+      // Subnormal or zero.
+      if (exp < -10) { return sign; }
+      mant |= 0x800000;
+      uint32_t shift = 14 - exp;
+      uint32_t out = mant >> shift;
+      uint32_t rem = mant & ((1u << shift) - 1);
+      uint32_t half = 1u << (shift - 1);
+      if (rem > half || (rem == half && (out & 1))) { ++out; }
+      return sign | out;
+    }
+    uint32_t out = ((uint32_t)exp << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1fff;
+    if (rem > 0x1000 || (rem == 0x1000 && (out & 1))) { ++out; }
+    return sign | out;
+  }
+  static float half2float(uint16_t value) {
+    uint32_t sign = (uint32_t)(value & 0x8000) << 16;
+    uint32_t exp = (value >> 10) & 0x1f;
+    uint32_t mant = value & 0x3ff;
+
+    uint32_t x;
+    if (exp == 0x1f) {
+      x = sign | 0x7f800000 | (mant << 13);
+    } else if (exp != 0) {
+      x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    } else if (mant == 0) {
+      x = sign;
+    } else {
+      // Normalize the subnormal.
+      exp = 127 - 15 + 1;
+      while ((mant & 0x400) == 0) {
+        mant <<= 1;
+        --exp;
+      }
+      x = sign | (exp << 23) | ((mant & 0x3ff) << 13);
+    }
+    float out;
+    std::memcpy(&out, &x, sizeof(out));
+    return out;
+  }
+};
+
+// Reinterpret the elements of an ndarray, e.g., a `ti::NdArray<uint16_t>` as
+// `TI_DATA_TYPE_F16`.
+inline TiNdArray reinterpret_ndarray(const TiNdArray& ndarray, TiDataType elem_type) {
+  TiNdArray out = ndarray;
+  out.elem_type = elem_type;
+  return out;
+}
+
+// Scalars other than i32 and f32 are passed as raw `TiScalar` bits.
+template<typename T>
+inline void to_ti_scalar(TiArgument& arg, TiDataType type, const T& value) {
+  arg.type = TI_ARGUMENT_TYPE_SCALAR;
+  arg.value.scalar.type = type;
+  std::memset(&arg.value.scalar.value, 0, sizeof(arg.value.scalar.value));
+  std::memcpy(&arg.value.scalar.value, &value, sizeof(T));
+}
+
 template<typename T>
 struct arg_conv_t {};
 template<>
@@ -22,6 +105,36 @@ struct arg_conv_t<float> {
   }
 };
 template<>
+struct arg_conv_t<int16_t> {
+  static inline void to_ti_arg(TiArgument& arg, int16_t value) {
+    to_ti_scalar(arg, TI_DATA_TYPE_I16, value);
+  }
+};
+template<>
+struct arg_conv_t<uint8_t> {
+  static inline void to_ti_arg(TiArgument& arg, uint8_t value) {
+    to_ti_scalar(arg, TI_DATA_TYPE_U8, value);
+  }
+};
+template<>
+struct arg_conv_t<f16_t> {
+  static inline void to_ti_arg(TiArgument& arg, f16_t value) {
+    to_ti_scalar(arg, TI_DATA_TYPE_F16, value.bits);
+  }
+};
+template<>
+struct arg_conv_t<int64_t> {
+  static inline void to_ti_arg(TiArgument& arg, int64_t value) {
+    to_ti_scalar(arg, TI_DATA_TYPE_I64, value);
+  }
+};
+template<>
+struct arg_conv_t<double> {
+  static inline void to_ti_arg(TiArgument& arg, double value) {
+    to_ti_scalar(arg, TI_DATA_TYPE_F64, value);
+  }
+};
+template<>
 struct arg_conv_t<TiNdArray> {
   static inline void to_ti_arg(TiArgument& arg, const TiNdArray& value) {
     arg.type = TI_ARGUMENT_TYPE_NDARRAY;
@@ -39,9 +152,14 @@ typedef std::unique_ptr<NamedArgument> NamedArgumentRef;
 
 
 
+struct FieldDecl;
+typedef std::shared_ptr<FieldDecl> FieldDeclRef;
+
 struct ParseResult {
   std::vector<NamedArgumentRef> args;
   std::vector<StmtRef> stmts;
+  // Global fields used by the kernel. Only set for the outermost frame.
+  std::vector<FieldDeclRef> fields;
 };
 
 
@@ -51,6 +169,10 @@ struct ParseFrame {
 };
 struct ParseContext {
   std::vector<ParseFrame> frames;
+  // Reset at the beginning of each trace.
+  uint32_t itervar_counter = 0;
+  uint32_t local_counter = 0;
+  std::vector<FieldDeclRef> fields;
 
   template<typename T>
   inline uint32_t reg_arg(const T& x) {
@@ -65,6 +187,9 @@ struct ParseContext {
     return iarg;
   }
 
+  std::string alloc_itervar_name();
+  std::string alloc_local_name();
+  void reg_field(const FieldDeclRef& field);
   void commit_stmt(const StmtRef& stmt);
 
   void start();
@@ -98,6 +223,9 @@ struct FloatValue {
   friend FloatValue operator+(const FloatValue& a, const FloatValue& b) {
     return FloatValue { AddExpr::create(a.expr_, b.expr_) };
   }
+  friend FloatValue operator-(const FloatValue& a, const FloatValue& b) {
+    return FloatValue { SubExpr::create(a.expr_, b.expr_) };
+  }
 };
 struct VectorValue {
   ExprRef expr_;
@@ -145,6 +273,24 @@ struct NdArrayValue {
     return NdArrayValue { IndexExpr::create(expr_, VectorExpr::create(std::move(idxs2))) };
   }
 
+  // Component `i` of the indexed vector element.
+  NdArrayValue component(int32_t i) const {
+    return NdArrayValue { IndexExpr::create(expr_, IntImmExpr::create(i)) };
+  }
+
+  // Read the indexed element.
+  VectorValue as_vector() const {
+    VectorValue out(std::vector<ExprRef> {});
+    out.expr_ = expr_;
+    return out;
+  }
+  IntValue as_int() const {
+    return IntValue { ExprRef(expr_) };
+  }
+  FloatValue as_float() const {
+    return FloatValue { ExprRef(expr_) };
+  }
+
   NdArrayValue& operator=(const IntValue& x) {
     StoreStmt::create(expr_, x.expr_)->commit();
     return *this;
@@ -165,7 +311,7 @@ struct ForControlFlow {
   StmtRef stmt_;
 
   ForControlFlow(const ExprRef& range) :
-    itervar_(IterVarExpr::create()),
+    itervar_(IterVarExpr::create(PARSE_CONTEXT.alloc_itervar_name())),
     range_(range) {}
 
   template<typename T>
@@ -183,6 +329,147 @@ struct ForControlFlow {
 #define TICPP_FOR(itervar, range) \
   ::ticpp::ForControlFlow(range.expr_) << [&](const ::ticpp::IterVarValue& itervar)
 
+struct RangeForControlFlow {
+  ExprRef itervar_;
+  ExprRef begin_;
+  ExprRef end_;
+  StmtRef stmt_;
+
+  RangeForControlFlow(const IntValue& begin, const IntValue& end) :
+    itervar_(IterVarExpr::create(PARSE_CONTEXT.alloc_itervar_name())),
+    begin_(begin.expr_),
+    end_(end.expr_) {}
+
+  template<typename T>
+  void operator<<(T block) {
+    // Kernel-level loops would otherwise be parallelized.
+    bool serialize = PARSE_CONTEXT.frames.size() == 1;
+
+    PARSE_CONTEXT.start();
+    block(IntValue { ExprRef(itervar_) });
+    ParseResult res = PARSE_CONTEXT.stop();
+    assert(res.args.empty());
+
+    stmt_ = RangeForStmt::create(std::move(itervar_), std::move(begin_),
+      std::move(end_), std::move(res.stmts), serialize);
+    stmt_->commit();
+  }
+};
+
+// Serial loop over `[begin, end)`, e.g., over a stencil window inside a
+// `TICPP_FOR` body.
+#define TICPP_RANGE_FOR(itervar, begin, end) \
+  ::ticpp::RangeForControlFlow((begin), (end)) << [&](const ::ticpp::IntValue& itervar)
+
+
+
+// Mutable kernel-local variables, emitted as Taichi locals so that
+// accumulations stay in registers. Reading a variable refers to the variable
+// rather than its current value; copy it into another variable to keep a
+// value across assignments.
+template<typename TValue>
+struct LocalVar : public TValue {
+  LocalVar(const TValue& init) :
+    TValue(LocalVarExpr::create(PARSE_CONTEXT.alloc_local_name(), true))
+  {
+    DeclareStmt::create(this->expr_, init.expr_)->commit();
+  }
+  LocalVar(const LocalVar& init) : LocalVar(static_cast<const TValue&>(init)) {}
+
+  LocalVar& operator=(const TValue& x) {
+    AssignStmt::create(this->expr_, "=", x.expr_)->commit();
+    return *this;
+  }
+  LocalVar& operator=(const LocalVar& x) {
+    return *this = static_cast<const TValue&>(x);
+  }
+  LocalVar& operator+=(const TValue& x) {
+    AssignStmt::create(this->expr_, "+=", x.expr_)->commit();
+    return *this;
+  }
+  LocalVar& operator-=(const TValue& x) {
+    AssignStmt::create(this->expr_, "-=", x.expr_)->commit();
+    return *this;
+  }
+};
+typedef LocalVar<IntValue> IntVar;
+typedef LocalVar<FloatValue> FloatVar;
+
+// An element of a `VectorVar`.
+struct VectorVarElem {
+  ExprRef expr_;
+
+  IntValue as_int() const {
+    return IntValue { ExprRef(expr_) };
+  }
+  FloatValue as_float() const {
+    return FloatValue { ExprRef(expr_) };
+  }
+
+  VectorVarElem& operator=(const IntValue& x) {
+    AssignStmt::create(expr_, "=", x.expr_)->commit();
+    return *this;
+  }
+  VectorVarElem& operator=(const FloatValue& x) {
+    AssignStmt::create(expr_, "=", x.expr_)->commit();
+    return *this;
+  }
+  VectorVarElem& operator+=(const IntValue& x) {
+    AssignStmt::create(expr_, "+=", x.expr_)->commit();
+    return *this;
+  }
+  VectorVarElem& operator+=(const FloatValue& x) {
+    AssignStmt::create(expr_, "+=", x.expr_)->commit();
+    return *this;
+  }
+  VectorVarElem& operator-=(const IntValue& x) {
+    AssignStmt::create(expr_, "-=", x.expr_)->commit();
+    return *this;
+  }
+  VectorVarElem& operator-=(const FloatValue& x) {
+    AssignStmt::create(expr_, "-=", x.expr_)->commit();
+    return *this;
+  }
+};
+
+struct VectorVar : public VectorValue {
+  VectorVar(const VectorValue& init) : VectorValue(std::vector<ExprRef> {}) {
+    expr_ = LocalVarExpr::create(PARSE_CONTEXT.alloc_local_name(), true);
+    DeclareStmt::create(expr_, to_local_vector(init))->commit();
+  }
+  VectorVar(std::initializer_list<IntValue> init) : VectorVar(VectorValue(init)) {}
+  VectorVar(std::initializer_list<FloatValue> init) : VectorVar(VectorValue(init)) {}
+  VectorVar(const VectorVar& init) : VectorVar(static_cast<const VectorValue&>(init)) {}
+
+  // Vector literals are tuples elsewhere but locals must be `ti.Vector`s.
+  static ExprRef to_local_vector(const VectorValue& x) {
+    if (dynamic_cast<const VectorExpr*>(x.expr_.get()) != nullptr) {
+      return TiVectorExpr::create(x.expr_);
+    }
+    return x.expr_;
+  }
+
+  VectorVarElem operator[](int32_t i) const {
+    return VectorVarElem { IndexExpr::create(expr_, IntImmExpr::create(i)) };
+  }
+
+  VectorVar& operator=(const VectorValue& x) {
+    AssignStmt::create(expr_, "=", to_local_vector(x))->commit();
+    return *this;
+  }
+  VectorVar& operator=(const VectorVar& x) {
+    return *this = static_cast<const VectorValue&>(x);
+  }
+  VectorVar& operator+=(const VectorValue& x) {
+    AssignStmt::create(expr_, "+=", to_local_vector(x))->commit();
+    return *this;
+  }
+  VectorVar& operator-=(const VectorValue& x) {
+    AssignStmt::create(expr_, "-=", to_local_vector(x))->commit();
+    return *this;
+  }
+};
+
 inline IntValue to_int(const FloatValue& value) {
   return IntValue { TypeCastExpr::create("ti.i32", value.expr_) };
 }
@@ -190,6 +477,41 @@ inline FloatValue to_float(const IntValue& value) {
   return FloatValue { TypeCastExpr::create("ti.f32", value.expr_) };
 }
 
+// Casts to other widths. Taichi infers expression types, so `IntValue` and
+// `FloatValue` hold integers and floats of any width.
+template<typename TValue>
+inline IntValue to_i8(const TValue& value) {
+  return IntValue { TypeCastExpr::create("ti.i8", value.expr_) };
+}
+template<typename TValue>
+inline IntValue to_i16(const TValue& value) {
+  return IntValue { TypeCastExpr::create("ti.i16", value.expr_) };
+}
+template<typename TValue>
+inline IntValue to_i64(const TValue& value) {
+  return IntValue { TypeCastExpr::create("ti.i64", value.expr_) };
+}
+template<typename TValue>
+inline IntValue to_u8(const TValue& value) {
+  return IntValue { TypeCastExpr::create("ti.u8", value.expr_) };
+}
+template<typename TValue>
+inline IntValue to_u16(const TValue& value) {
+  return IntValue { TypeCastExpr::create("ti.u16", value.expr_) };
+}
+template<typename TValue>
+inline IntValue to_u32(const TValue& value) {
+  return IntValue { TypeCastExpr::create("ti.u32", value.expr_) };
+}
+template<typename TValue>
+inline FloatValue to_f16(const TValue& value) {
+  return FloatValue { TypeCastExpr::create("ti.f16", value.expr_) };
+}
+template<typename TValue>
+inline FloatValue to_f64(const TValue& value) {
+  return FloatValue { TypeCastExpr::create("ti.f64", value.expr_) };
+}
+
 
 
 
@@ -213,6 +535,38 @@ struct expr_conv_t<float> {
     return FloatValue { FloatImmExpr::create("_" + std::to_string(PARSE_CONTEXT.reg_arg(value)), value) };
   }
 };
+// Other scalar widths are typed by their graph argument symbols. Named
+// immediates are never folded, so the traced value is only a sample.
+template<>
+struct expr_conv_t<int16_t> {
+  static inline IntValue to_expr(int16_t value) {
+    return IntValue { IntImmExpr::create("_" + std::to_string(PARSE_CONTEXT.reg_arg(value)), value) };
+  }
+};
+template<>
+struct expr_conv_t<uint8_t> {
+  static inline IntValue to_expr(uint8_t value) {
+    return IntValue { IntImmExpr::create("_" + std::to_string(PARSE_CONTEXT.reg_arg(value)), value) };
+  }
+};
+template<>
+struct expr_conv_t<f16_t> {
+  static inline FloatValue to_expr(f16_t value) {
+    return FloatValue { FloatImmExpr::create("_" + std::to_string(PARSE_CONTEXT.reg_arg(value)), (float)value) };
+  }
+};
+template<>
+struct expr_conv_t<int64_t> {
+  static inline IntValue to_expr(int64_t value) {
+    return IntValue { IntImmExpr::create("_" + std::to_string(PARSE_CONTEXT.reg_arg(value)), (int32_t)value) };
+  }
+};
+template<>
+struct expr_conv_t<double> {
+  static inline FloatValue to_expr(double value) {
+    return FloatValue { FloatImmExpr::create("_" + std::to_string(PARSE_CONTEXT.reg_arg(value)), (float)value) };
+  }
+};
 template<>
 struct expr_conv_t<TiNdArray> {
   static inline NdArrayValue to_expr(const TiNdArray& value) {
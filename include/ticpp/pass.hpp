@@ -0,0 +1,135 @@
+// IR optimization passes over traced kernels.
+// @PENGUINLIONG
+#pragma once
+#include "ticpp/parse_context.hpp"
+
+namespace ticpp {
+
+// Options controlling how a traced kernel is lowered.
+struct KernelConfig {
+  // Bake traced ndarray shapes into the kernel so that loop extents are
+  // compile-time constants. A variant is compiled per distinct set of shapes.
+  bool specialize_shapes = false;
+  // Launches with more distinct shapes than this use the shape-generic
+  // kernel instead.
+  uint32_t max_shape_variants = 4;
+  // Threads per block of kernel-level loops; 0 leaves it to Taichi.
+  uint32_t block_dim = 0;
+};
+
+struct PassStats {
+  std::string name;
+  // Number of rewrites the pass applied.
+  uint32_t nrewrite;
+};
+
+struct Pass {
+  virtual ~Pass() {}
+  virtual const char* name() const = 0;
+  // Rewrite `itm` in place and return the number of rewrites applied.
+  virtual uint32_t run(ParseResult& itm) = 0;
+};
+typedef std::unique_ptr<Pass> PassRef;
+
+// Fold arithmetic and casts on integer and float literals. Kernel arguments
+// are never folded.
+struct ConstantFoldingPass : public Pass {
+  inline static PassRef create() {
+    return std::make_unique<ConstantFoldingPass>();
+  }
+
+  virtual const char* name() const override {
+    return "constant_folding";
+  }
+  virtual uint32_t run(ParseResult& itm) override;
+};
+
+// Remove ndarray stores that are overwritten later in the same block, i.e.,
+// in the same loop iteration, without being read in between.
+struct DeadStoreEliminationPass : public Pass {
+  inline static PassRef create() {
+    return std::make_unique<DeadStoreEliminationPass>();
+  }
+
+  virtual const char* name() const override {
+    return "dead_store_elimination";
+  }
+  virtual uint32_t run(ParseResult& itm) override;
+};
+
+// Hoist subexpressions that don't depend on the loop index, on mutable locals
+// or on ndarray contents out of serial loops nested in kernel-level loops,
+// into locals declared right before the inner loop.
+struct LoopInvariantCodeMotionPass : public Pass {
+  inline static PassRef create() {
+    return std::make_unique<LoopInvariantCodeMotionPass>();
+  }
+
+  virtual const char* name() const override {
+    return "loop_invariant_code_motion";
+  }
+  virtual uint32_t run(ParseResult& itm) override;
+};
+
+// Replace loops over ndarrays with loops over constant ranges of the traced
+// ndarray shapes.
+struct ShapeSpecializationPass : public Pass {
+  inline static PassRef create() {
+    return std::make_unique<ShapeSpecializationPass>();
+  }
+
+  virtual const char* name() const override {
+    return "shape_specialization";
+  }
+  virtual uint32_t run(ParseResult& itm) override;
+};
+
+// Rewrite accesses to SoA ndarrays into per-component accesses of the
+// underlying scalar ndarrays, and loops over them into loops over their
+// spatial dimensions.
+struct SoaLoweringPass : public Pass {
+  inline static PassRef create() {
+    return std::make_unique<SoaLoweringPass>();
+  }
+
+  virtual const char* name() const override {
+    return "soa_lowering";
+  }
+  virtual uint32_t run(ParseResult& itm) override;
+};
+
+// Set the block dim of kernel-level loops.
+struct LoopConfigPass : public Pass {
+  uint32_t block_dim;
+
+  inline static PassRef create(uint32_t block_dim) {
+    std::unique_ptr<LoopConfigPass> out = std::make_unique<LoopConfigPass>();
+    out->block_dim = block_dim;
+    return out;
+  }
+
+  virtual const char* name() const override {
+    return "loop_config";
+  }
+  virtual uint32_t run(ParseResult& itm) override;
+};
+
+struct PassManager {
+  std::vector<PassRef> passes;
+
+  // SoA lowering, constant folding, dead store elimination and loop-invariant
+  // code motion, plus the passes requested by `cfg`.
+  static PassManager create_default(const KernelConfig& cfg = {});
+
+  inline PassManager& add(PassRef&& pass) {
+    passes.emplace_back(std::move(pass));
+    return *this;
+  }
+  std::vector<PassStats> run(ParseResult& itm) const;
+};
+
+// Only prints if the `TICPP_PRINT_PASS_STATS` environment variable is set to
+// anything other than `0`.
+extern void print_pass_stats(const std::vector<PassStats>& stats);
+
+} // namespace ticpp
@@ -0,0 +1,284 @@
+// Sharded launches over multiple runtimes.
+//
+// A `ShardedNdArray` splits the outer dimension of an ndarray into one
+// contiguous shard per runtime, optionally padded with `halo` rows on both
+// sides for stencils. A `ShardedKernel` instantiates the kernel once per
+// runtime and launches all shards concurrently from persistent per-shard
+// workers; `launch_async` returns per-shard events instead of blocking.
+//
+//   std::vector<ti::Runtime> runtimes = ...;
+//   ticpp::ShardedNdArray<float> arr(runtimes, {1024, 1024}, {}, 1);
+//   arr.scatter(host_data);
+//   auto k = ticpp::to_sharded_kernel(runtimes, kernel_impl);
+//   k.launch(ticpp::shard_offset(arr), arr);
+//   arr.exchange_halo();
+//   arr.gather(host_data);
+//
+// @PENGUINLIONG
+#pragma once
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <future>
+#include <thread>
+#include "ticpp/codegen.hpp"
+
+namespace ticpp {
+
+template<typename T>
+struct ShardedNdArray {
+  std::vector<uint32_t> shape_;
+  std::vector<uint32_t> elem_shape_;
+  uint32_t halo_;
+  // Outer rows owned by each shard, excluding halos.
+  std::vector<uint32_t> offsets_;
+  std::vector<uint32_t> extents_;
+  // Each shard has `extents_[i] + 2 * halo_` outer rows.
+  std::vector<ti::NdArray<T>> shards_;
+
+  ShardedNdArray(
+    std::vector<ti::Runtime>& runtimes,
+    const std::vector<uint32_t>& shape,
+    const std::vector<uint32_t>& elem_shape,
+    uint32_t halo = 0
+  ) : shape_(shape), elem_shape_(elem_shape), halo_(halo) {
+    assert(!shape.empty());
+    uint32_t nshard = runtimes.size();
+    uint32_t offset = 0;
+    for (uint32_t i = 0; i < nshard; ++i) {
+      uint32_t extent = shape.at(0) / nshard + (i < shape.at(0) % nshard ? 1 : 0);
+      offsets_.emplace_back(offset);
+      extents_.emplace_back(extent);
+      offset += extent;
+
+      std::vector<uint32_t> shard_shape = shape;
+      shard_shape.at(0) = extent + 2 * halo;
+      shards_.emplace_back(runtimes.at(i).allocate_ndarray<T>(shard_shape, elem_shape, true));
+    }
+  }
+
+  // Number of elements in an outer row.
+  size_t row_size() const {
+    size_t out = 1;
+    for (size_t i = 1; i < shape_.size(); ++i) {
+      out *= shape_.at(i);
+    }
+    for (uint32_t x : elem_shape_) {
+      out *= x;
+    }
+    return out;
+  }
+
+  // Upload the full array. Halo rows are filled from neighboring shards, or
+  // zeros at the array boundaries.
+  void scatter(const std::vector<T>& src) {
+    size_t nrow = shape_.at(0);
+    size_t row = row_size();
+    assert(src.size() == nrow * row);
+
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      std::vector<T> shard((extents_.at(i) + 2 * halo_) * row);
+      for (size_t j = 0; j < extents_.at(i) + 2 * halo_; ++j) {
+        int64_t global_row = (int64_t)offsets_.at(i) + (int64_t)j - halo_;
+        if (global_row < 0 || global_row >= (int64_t)nrow) { continue; }
+        std::copy(
+          src.begin() + global_row * row,
+          src.begin() + (global_row + 1) * row,
+          shard.begin() + j * row);
+      }
+      shards_.at(i).write(shard);
+    }
+  }
+
+  // Download the rows owned by each shard into the full array.
+  void gather(std::vector<T>& dst) const {
+    size_t row = row_size();
+    dst.resize(shape_.at(0) * row);
+
+    for (size_t i = 0; i < shards_.size(); ++i) {
+      std::vector<T> shard((extents_.at(i) + 2 * halo_) * row);
+      shards_.at(i).read(shard);
+      std::copy(
+        shard.begin() + halo_ * row,
+        shard.begin() + (halo_ + extents_.at(i)) * row,
+        dst.begin() + offsets_.at(i) * row);
+    }
+  }
+
+  // Refresh halo rows with the rows owned by neighboring shards. Only the
+  // boundary rows are copied, through mapped memory, so wait for the runtimes
+  // first.
+  void exchange_halo() {
+    if (halo_ == 0 || shards_.size() < 2) { return; }
+    // Halos reaching past the neighbor are staged through the full array.
+    for (uint32_t extent : extents_) {
+      if (extent < halo_) {
+        std::vector<T> full;
+        gather(full);
+        scatter(full);
+        return;
+      }
+    }
+
+    size_t row = row_size();
+    std::vector<T*> shards;
+    for (const ti::NdArray<T>& shard : shards_) {
+      shards.emplace_back((T*)shard.map());
+    }
+    for (size_t i = 0; i + 1 < shards.size(); ++i) {
+      T* lo = shards.at(i);
+      T* hi = shards.at(i + 1);
+      size_t nlo = extents_.at(i);
+      // Last owned rows of the lower shard to the leading halo of the upper.
+      std::copy(lo + nlo * row, lo + (nlo + halo_) * row, hi);
+      // First owned rows of the upper shard to the trailing halo of the lower.
+      std::copy(hi + halo_ * row, hi + 2 * halo_ * row, lo + (halo_ + nlo) * row);
+    }
+    for (const ti::NdArray<T>& shard : shards_) {
+      shard.unmap();
+    }
+  }
+};
+
+// Placeholder argument replaced by the global index of each shard's first
+// outer row, including its halo.
+struct ShardOffset {
+  const std::vector<uint32_t>* offsets;
+  uint32_t halo;
+};
+template<typename T>
+ShardOffset shard_offset(const ShardedNdArray<T>& x) {
+  return ShardOffset { &x.offsets_, x.halo_ };
+}
+
+template<typename T>
+const T& shard_arg(const T& x, uint32_t i) {
+  return x;
+}
+template<typename T>
+const TiNdArray& shard_arg(const ShardedNdArray<T>& x, uint32_t i) {
+  return x.shards_.at(i).ndarray();
+}
+inline int32_t shard_arg(const ShardOffset& x, uint32_t i) {
+  return (int32_t)x.offsets->at(i) - (int32_t)x.halo;
+}
+
+// Thread kept alive across launches to submit the work of one shard.
+struct ShardWorker {
+  std::mutex mutex_;
+  std::condition_variable cv_;
+  std::deque<std::function<void()>> tasks_;
+  bool stop_ = false;
+  // Started last, after everything it uses.
+  std::thread thread_;
+
+  ShardWorker() : thread_([this]() { run(); }) {}
+  ShardWorker(const ShardWorker&) = delete;
+  ShardWorker& operator=(const ShardWorker&) = delete;
+  ~ShardWorker() {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      stop_ = true;
+    }
+    cv_.notify_one();
+    thread_.join();
+  }
+
+  // Run `f` on the worker. Exceptions are rethrown by the returned future.
+  template<typename TFunc>
+  std::future<std::invoke_result_t<TFunc>> submit(TFunc f) {
+    typedef std::invoke_result_t<TFunc> TResult;
+    auto task = std::make_shared<std::packaged_task<TResult()>>(std::move(f));
+    std::future<TResult> out = task->get_future();
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      tasks_.emplace_back([task]() { (*task)(); });
+    }
+    cv_.notify_one();
+    return out;
+  }
+
+  void run() {
+    for (;;) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return stop_ || !tasks_.empty(); });
+        if (tasks_.empty()) { return; }
+        task = std::move(tasks_.front());
+        tasks_.pop_front();
+      }
+      task();
+    }
+  }
+};
+
+template<typename TFunc>
+struct ShardedKernel {};
+template<typename ... TValues>
+struct ShardedKernel<std::function<void(TValues ...)>> {
+  std::vector<Kernel<std::function<void(TValues ...)>>> kernels_;
+  std::vector<std::unique_ptr<ShardWorker>> workers_;
+
+  ShardedKernel(
+    const std::vector<ti::Runtime>& runtimes,
+    std::function<void(TValues ...)> fn,
+    const KernelConfig& config = {}
+  ) {
+    for (const ti::Runtime& runtime : runtimes) {
+      kernels_.emplace_back(runtime, fn, config);
+      workers_.emplace_back(std::make_unique<ShardWorker>());
+    }
+  }
+
+  // Launch all shards concurrently and return once every shard is submitted,
+  // with one event per shard. Each kernel is instantiated on its first
+  // launch, in parallel.
+  template<typename ... TArgs>
+  std::vector<LaunchEvent> launch_async(const TArgs& ... args) {
+    std::vector<std::future<LaunchEvent>> futures;
+    for (uint32_t i = 0; i < kernels_.size(); ++i) {
+      futures.emplace_back(workers_.at(i)->submit([&, i]() {
+        return kernels_.at(i).launch_async(shard_arg(args, i) ...);
+      }));
+    }
+
+    // Wait for every shard before rethrowing since tasks refer to `args`.
+    std::vector<LaunchEvent> out;
+    std::exception_ptr error;
+    for (std::future<LaunchEvent>& future : futures) {
+      try {
+        out.emplace_back(future.get());
+      } catch (...) {
+        if (!error) { error = std::current_exception(); }
+      }
+    }
+    if (error) { std::rethrow_exception(error); }
+    return out;
+  }
+
+  // Launch all shards concurrently and wait for them to finish.
+  template<typename ... TArgs>
+  void launch(const TArgs& ... args) {
+    for (const LaunchEvent& event : launch_async(args ...)) {
+      event.wait();
+    }
+  }
+
+  template<typename ... TArgs>
+  void operator()(const TArgs& ... args) {
+    launch(args ...);
+  }
+};
+
+template<typename TFunc>
+auto to_sharded_kernel(
+  const std::vector<ti::Runtime>& runtimes,
+  TFunc f,
+  const KernelConfig& config = {}
+) {
+  typename get_func_ty<TFunc>::type func { f };
+  return ShardedKernel<typename get_func_ty<TFunc>::type>(runtimes, std::move(func), config);
+}
+
+} // namespace ticpp
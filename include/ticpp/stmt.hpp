@@ -9,6 +9,13 @@ struct Stmt : std::enable_shared_from_this<Stmt> {
   virtual ~Stmt() {}
   virtual void to_string(PythonScriptWriter& ss) const = 0;
 
+  // Used by IR passes. `map_exprs` replaces each expression operand in place
+  // with `f(expr)`; `blocks` returns nested statement blocks.
+  virtual void map_exprs(const ExprMapper& f) {}
+  virtual std::vector<std::vector<std::shared_ptr<Stmt>>*> blocks() {
+    return {};
+  }
+
   template<typename T>
   inline static std::shared_ptr<Stmt> create(T&& x) {
     return std::shared_ptr<Stmt>(static_cast<Stmt*>(new T(std::move(x))));
@@ -38,12 +45,86 @@ struct StoreStmt : public Stmt {
     value_->to_string(ss);
     ss << ")";
   }
+  virtual void map_exprs(const ExprMapper& f) override {
+    dst_ = f(dst_);
+    value_ = f(value_);
+  }
+};
+
+// Evaluate `expr_` for its side effects.
+struct EvalStmt : public Stmt {
+  ExprRef expr_;
+
+  inline static StmtRef create(const ExprRef& expr) {
+    EvalStmt out {};
+    out.expr_ = expr;
+    return Stmt::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    expr_->to_string(ss);
+  }
+  virtual void map_exprs(const ExprMapper& f) override {
+    expr_ = f(expr_);
+  }
+};
+
+// Declare a kernel-local variable `var_` initialized with `init_`.
+struct DeclareStmt : public Stmt {
+  ExprRef var_;
+  ExprRef init_;
+
+  inline static StmtRef create(const ExprRef& var, const ExprRef& init) {
+    DeclareStmt out {};
+    out.var_ = var;
+    out.init_ = init;
+    return Stmt::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    var_->to_string(ss);
+    ss << " = (";
+    init_->to_string(ss);
+    ss << ")";
+  }
+  virtual void map_exprs(const ExprMapper& f) override {
+    init_ = f(init_);
+  }
+};
+
+// Assign to a mutable kernel-local variable, or to an element of one. `op_`
+// is `=` or a compound assignment operator like `+=`.
+struct AssignStmt : public Stmt {
+  ExprRef dst_;
+  std::string op_;
+  ExprRef value_;
+
+  inline static StmtRef create(const ExprRef& dst, const std::string& op, const ExprRef& value) {
+    AssignStmt out {};
+    out.dst_ = dst;
+    out.op_ = op;
+    out.value_ = value;
+    return Stmt::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    dst_->to_string(ss);
+    ss << " " << op_ << " (";
+    value_->to_string(ss);
+    ss << ")";
+  }
+  virtual void map_exprs(const ExprMapper& f) override {
+    value_ = f(value_);
+  }
 };
 
 struct ForStmt : public Stmt {
   ExprRef index_;
   ExprRef range_;
   std::vector<StmtRef> then_block_;
+  // Threads per block of the parallelized loop; 0 leaves it to Taichi. Only
+  // effective on kernel-level loops.
+  uint32_t block_dim_ = 0;
 
   inline static StmtRef create(
     ExprRef&& index,
@@ -58,6 +139,10 @@ struct ForStmt : public Stmt {
   }
 
   virtual void to_string(PythonScriptWriter& ss) const override {
+    if (block_dim_ != 0) {
+      ss << "ti.loop_config(block_dim=" << block_dim_ << ")";
+      ss.commit_line();
+    }
     ss << "for ";
     index_->to_string(ss);
     ss << " in ti.grouped(";
@@ -71,6 +156,72 @@ struct ForStmt : public Stmt {
     }
     ss.pop_indent();
   }
+  virtual void map_exprs(const ExprMapper& f) override {
+    range_ = f(range_);
+  }
+  virtual std::vector<std::vector<StmtRef>*> blocks() override {
+    return { &then_block_ };
+  }
+};
+
+// A serial loop `for index_ in range(begin_, end_)`. Loops nested in other
+// loops are always serial in Taichi; kernel-level ones are explicitly
+// serialized.
+struct RangeForStmt : public Stmt {
+  ExprRef index_;
+  ExprRef begin_;
+  ExprRef end_;
+  std::vector<StmtRef> then_block_;
+  bool serialize_;
+
+  inline static StmtRef create(
+    ExprRef&& index,
+    ExprRef&& begin,
+    ExprRef&& end,
+    std::vector<StmtRef>&& then_block,
+    bool serialize
+  ) {
+    RangeForStmt out {};
+    out.index_ = std::move(index);
+    out.begin_ = std::move(begin);
+    out.end_ = std::move(end);
+    out.then_block_ = std::move(then_block);
+    out.serialize_ = serialize;
+    return Stmt::create(std::move(out));
+  }
+
+  virtual void to_string(PythonScriptWriter& ss) const override {
+    if (serialize_) {
+      ss << "ti.loop_config(serialize=True)";
+      ss.commit_line();
+    }
+    ss << "for ";
+    index_->to_string(ss);
+    ss << " in range(";
+    begin_->to_string(ss);
+    ss << ", ";
+    end_->to_string(ss);
+    ss << "):";
+    ss.commit_line();
+    ss.push_indent();
+    for (const StmtRef& stmt : then_block_) {
+      stmt->to_string(ss);
+      ss.commit_line();
+    }
+    // Taichi doesn't accept empty loop bodies.
+    if (then_block_.empty()) {
+      ss << "pass";
+      ss.commit_line();
+    }
+    ss.pop_indent();
+  }
+  virtual void map_exprs(const ExprMapper& f) override {
+    begin_ = f(begin_);
+    end_ = f(end_);
+  }
+  virtual std::vector<std::vector<StmtRef>*> blocks() override {
+    return { &then_block_ };
+  }
 };
 
 } // namespace ticpp
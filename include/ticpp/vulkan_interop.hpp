@@ -0,0 +1,27 @@
+// Vulkan interop through the C-API.
+//
+// Only available on Vulkan runtimes when the C-API's Vulkan interop is
+// enabled with `TI_WITH_VULKAN` (see `TICPP_WITH_VULKAN` in CMake). The C-API
+// builds with `VK_NO_PROTOTYPES`, so Vulkan functions are loaded from the
+// runtime's `get_instance_proc_addr`.
+// @PENGUINLIONG
+#pragma once
+#include "ticpp/common.hpp"
+
+namespace ticpp {
+
+// Name of the physical device behind `runtime` followed by its vendor and
+// device IDs, e.g., `NVIDIA GeForce RTX 3080 10de:2206`. Returns false if
+// unavailable.
+extern bool get_vulkan_device_name(TiArch arch, TiRuntime runtime, std::string& name);
+
+// Host-side status query of events signaled on a Vulkan runtime.
+struct VulkanEventQuery;
+typedef std::shared_ptr<VulkanEventQuery> VulkanEventQueryRef;
+
+// Returns null if unavailable.
+extern VulkanEventQueryRef create_vulkan_event_query(TiArch arch, TiRuntime runtime);
+// Whether `event` has been signaled. Never blocks.
+extern bool is_vulkan_event_set(const VulkanEventQuery& query, TiEvent event);
+
+} // namespace ticpp
@@ -0,0 +1,12 @@
+#include "demo.hpp"
+
+void kernel_impl(ticpp::IntValue i, ticpp::FloatValue f, ticpp::NdArrayValue ndarray) {
+  TICPP_FOR(idxs, ndarray) {
+    ndarray[idxs] = ticpp::VectorValue({
+      ticpp::to_float(idxs[0]),
+      ticpp::to_float(idxs[1]) + f
+    });
+  };
+}
+TICPP_REGISTER_KERNEL(kernel_impl, kernel_impl, 1, 1.23f,
+  ticpp::ndarray_sig(TI_DATA_TYPE_F32, {4, 8}, {2}));
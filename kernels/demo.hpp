@@ -0,0 +1,6 @@
+// Demo kernels.
+// @PENGUINLIONG
+#pragma once
+#include "ticpp/aot_bundle.hpp"
+
+extern void kernel_impl(ticpp::IntValue i, ticpp::FloatValue f, ticpp::NdArrayValue ndarray);
@@ -0,0 +1,19 @@
+#!/bin/bash
+set -e
+
+# Usage: ./scripts/bench-linux.sh [--arch=vulkan|x64] [--filter=<substr>]
+#
+# On machines without a GPU, either run with `--arch=x64` (requires Taichi
+# built with `TI_WITH_LLVM=ON`) or point `VK_ICD_FILENAMES` at a software
+# Vulkan driver, e.g. `/usr/share/vulkan/icd.d/lvp_icd.x86_64.json`.
+
+rm -rf build-bench-linux
+mkdir build-bench-linux
+pushd build-bench-linux
+TAICHI_C_API_INSTALL_DIR="${PWD}/../build-taichi-linux/install/c_api" cmake .. \
+    -DCMAKE_BUILD_TYPE=Release \
+    -DTICPP_BUILD_BENCH=ON
+cmake --build . -t ticpp_bench
+popd
+
+TICPP_PYTHON="${TICPP_PYTHON:-$(which python3)}" ./build-bench-linux/ticpp_bench --json=ticpp_bench.json "$@"
@@ -8,6 +8,9 @@ else
     echo "TAICHI_REPO_DIR is set to ${TAICHI_REPO_DIR}"
 fi
 
+# The x64 backend and sparse fields need LLVM.
+TICPP_WITH_LLVM="${TICPP_WITH_LLVM:-OFF}"
+
 rm -rf build-taichi-linux
 mkdir build-taichi-linux
 pushd build-taichi-linux
@@ -16,8 +19,8 @@ cmake $TAICHI_REPO_DIR \
     -G "Ninja" \
     -DTI_WITH_C_API=ON \
     -DTI_WITH_VULKAN=ON \
-    -DTI_WITH_CPU=OFF \
-    -DTI_WITH_LLVM=OFF \
+    -DTI_WITH_CPU=${TICPP_WITH_LLVM} \
+    -DTI_WITH_LLVM=${TICPP_WITH_LLVM} \
     -DTI_WITH_CUDA=OFF \
     -DTI_WITH_PYTHON=OFF \
     -DTI_WITH_CC=OFF
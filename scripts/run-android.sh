@@ -21,8 +21,19 @@ if [ $? -ne 0 ]; then
 fi
 popd
 
-if [[ ! -f "./module/metadata.tcb" ]]; then
-    echo "Did you run python app.py --arch=vulkan?"
+# Kernels can't be compiled on device, and the AOT bundle is skipped when
+# cross-compiling, so build it on the host with the host C-API.
+rm -rf build-linux-aot-bundle
+mkdir build-linux-aot-bundle
+pushd build-linux-aot-bundle
+TAICHI_C_API_INSTALL_DIR="${PWD}/../build-taichi-linux/install/c_api" cmake .. \
+    -DTICPP_BUILD_AOT_BUNDLE=ON \
+    -DTICPP_AOT_BUNDLE_ARCH=vulkan
+cmake --build . --target ticpp_aot_bundle
+popd
+
+if [[ ! -f "./build-linux-aot-bundle/aot_bundle/metadata.tcb" ]]; then
+    echo "AOT module was not generated"
     exit -1
 fi
 
@@ -30,7 +41,7 @@ adb shell rm -rf /data/local/tmp/taichi-aot/
 adb shell mkdir /data/local/tmp/taichi-aot/
 adb push ./build-android-aarch64/TaichiAot /data/local/tmp/taichi-aot/
 adb push ./build-android-aarch64/libtaichi_c_api.so /data/local/tmp/taichi-aot/
-adb push ./module /data/local/tmp/taichi-aot/
+adb push ./build-linux-aot-bundle/aot_bundle /data/local/tmp/taichi-aot/module
 adb push ./scripts/__android_main.sh /data/local/tmp/taichi-aot/
 adb shell chmod 755 /data/local/tmp/taichi-aot/__android_main.sh
 adb shell sh /data/local/tmp/taichi-aot/__android_main.sh
@@ -4,13 +4,17 @@ set -e
 rm -rf build-linux
 mkdir build-linux
 pushd build-linux
-TAICHI_C_API_INSTALL_DIR="${PWD}/../build-taichi-linux/install/c_api" cmake ..
+TAICHI_C_API_INSTALL_DIR="${PWD}/../build-taichi-linux/install/c_api" cmake .. \
+    -DTICPP_BUILD_AOT_BUNDLE=ON
 cmake --build .
 popd
 
-if [[ ! -f "./module/metadata.tcb" ]]; then
-    echo "Did you generated AOT module?"
+if [[ ! -f "./build-linux/module/metadata.tcb" ]]; then
+    echo "AOT module was not generated"
     exit -1
 fi
 
-./build-linux/TaichiAot
+# The prebuilt module is installed next to the app.
+pushd build-linux
+./TaichiAot
+popd
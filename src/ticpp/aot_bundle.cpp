@@ -0,0 +1,47 @@
+#include <filesystem>
+#include "ticpp/aot_bundle.hpp"
+
+namespace ticpp {
+
+std::vector<RegisteredKernel>& get_registered_kernels() {
+  // Function-local so registration from static initializers in other
+  // translation units is well-ordered.
+  static std::vector<RegisteredKernel> kernels_;
+  return kernels_;
+}
+
+void compile_aot_bundle(TiArch arch, const std::string& module_dir) {
+  std::vector<std::pair<std::string, ParseResult>> itms;
+  for (RegisteredKernel& kernel : get_registered_kernels()) {
+    ParseResult itm = kernel.trace();
+    print_pass_stats(PassManager::create_default().run(itm));
+    itms.emplace_back(kernel.name, std::move(itm));
+  }
+
+  std::string script = composite_python_bundle_script(arch, itms);
+  print_script(script);
+
+  std::string scratch_dir = make_aot_scratch_dir();
+  try {
+    dump_aot_script(scratch_dir, script);
+    std::filesystem::create_directories(module_dir);
+    std::filesystem::copy(
+      load_aot_module_path(scratch_dir),
+      module_dir,
+      std::filesystem::copy_options::recursive |
+        std::filesystem::copy_options::overwrite_existing);
+  } catch (...) {
+    remove_aot_artifact(scratch_dir);
+    throw;
+  }
+  remove_aot_artifact(scratch_dir);
+}
+
+std::shared_ptr<ti::AotModule> load_aot_bundle(
+  ti::Runtime& runtime,
+  const std::string& module_dir
+) {
+  return std::make_shared<ti::AotModule>(runtime.load_aot_module(module_dir));
+}
+
+} // namespace ticpp
@@ -0,0 +1,174 @@
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cerrno>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <map>
+#include <mutex>
+#include "ticpp/codegen.hpp"
+#include "ticpp/vulkan_interop.hpp"
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#include <process.h>
+#else
+#include <fcntl.h>
+#include <sys/file.h>
+#include <unistd.h>
+#endif
+
+namespace ticpp {
+
+// FNV-1a, so that keys are stable across builds and platforms.
+static uint64_t hash_str(const std::string& x) {
+  uint64_t out = 0xcbf29ce484222325ull;
+  for (char c : x) {
+    out ^= (uint8_t)c;
+    out *= 0x100000001b3ull;
+  }
+  return out;
+}
+
+std::string get_autotune_device_name(TiArch arch, TiRuntime runtime) {
+  const char* name = std::getenv("TICPP_DEVICE_NAME");
+  std::string out;
+  if (name != nullptr && *name != '\0') {
+    out = name;
+  } else if (!get_vulkan_device_name(arch, runtime, out)) {
+    out = "default";
+  }
+  // Keys are whitespace-separated in the cache file.
+  std::replace_if(out.begin(), out.end(), [](char c) { return std::isspace((unsigned char)c); }, '_');
+  return out;
+}
+std::string make_autotune_key(
+  TiArch arch,
+  TiRuntime runtime,
+  const std::string& script,
+  const std::string& shape_key
+) {
+  std::stringstream ss;
+  ss << arch2str(arch) << "/" << get_autotune_device_name(arch, runtime) << "/"
+    << std::hex << std::setw(16) << std::setfill('0') << hash_str(script + "\n" + shape_key);
+  return ss.str();
+}
+
+std::string get_autotune_cache_path() {
+  const char* cache_dir = std::getenv("TICPP_CACHE_DIR");
+  std::filesystem::path dir = cache_dir != nullptr ? cache_dir : ".ticpp";
+  return (dir / "autotune.txt").string();
+}
+
+// Each line is `<key> <block_dim> <specialize_shapes>`.
+static std::mutex AUTOTUNE_CACHE_MUTEX;
+
+// Exclusive lock on a file shared by all processes, held while alive.
+struct FileLock {
+#ifdef _WIN32
+  HANDLE handle_;
+
+  FileLock(const std::string& path) {
+    handle_ = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE,
+      FILE_SHARE_READ | FILE_SHARE_WRITE | FILE_SHARE_DELETE, nullptr,
+      OPEN_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+    OVERLAPPED overlapped {};
+    if (handle_ == INVALID_HANDLE_VALUE ||
+      !LockFileEx(handle_, LOCKFILE_EXCLUSIVE_LOCK, 0, MAXDWORD, MAXDWORD, &overlapped)) {
+      if (handle_ != INVALID_HANDLE_VALUE) { CloseHandle(handle_); }
+      throw std::runtime_error("cannot lock " + path);
+    }
+  }
+  ~FileLock() {
+    OVERLAPPED overlapped {};
+    UnlockFileEx(handle_, 0, MAXDWORD, MAXDWORD, &overlapped);
+    CloseHandle(handle_);
+  }
+#else
+  int fd_;
+
+  FileLock(const std::string& path) {
+    fd_ = open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    int ret = -1;
+    if (fd_ >= 0) {
+      do {
+        ret = flock(fd_, LOCK_EX);
+      } while (ret != 0 && errno == EINTR);
+    }
+    if (ret != 0) {
+      if (fd_ >= 0) { close(fd_); }
+      throw std::runtime_error("cannot lock " + path);
+    }
+  }
+  ~FileLock() {
+    flock(fd_, LOCK_UN);
+    close(fd_);
+  }
+#endif
+  FileLock(const FileLock&) = delete;
+  FileLock& operator=(const FileLock&) = delete;
+};
+
+static std::string make_tmp_cache_path(const std::string& path) {
+  static std::atomic<uint64_t> counter_ { 0 };
+#ifdef _WIN32
+  int pid = _getpid();
+#else
+  int pid = getpid();
+#endif
+  return path + ".tmp." + std::to_string(pid) + "." + std::to_string(counter_++);
+}
+
+static std::map<std::string, KernelConfig> read_tuned_configs(const std::string& path) {
+  std::map<std::string, KernelConfig> out;
+  std::ifstream f(path);
+  std::string line;
+  while (std::getline(f, line)) {
+    std::stringstream ss(line);
+    std::string key;
+    KernelConfig cfg {};
+    if (ss >> key >> cfg.block_dim >> cfg.specialize_shapes) {
+      out[key] = cfg;
+    }
+  }
+  return out;
+}
+
+bool load_tuned_config(const std::string& key, KernelConfig& cfg) {
+  std::lock_guard<std::mutex> guard(AUTOTUNE_CACHE_MUTEX);
+  std::map<std::string, KernelConfig> cfgs = read_tuned_configs(get_autotune_cache_path());
+  auto it = cfgs.find(key);
+  if (it == cfgs.end()) { return false; }
+  cfg.block_dim = it->second.block_dim;
+  cfg.specialize_shapes = it->second.specialize_shapes;
+  return true;
+}
+void save_tuned_config(const std::string& key, const KernelConfig& cfg) {
+  std::lock_guard<std::mutex> guard(AUTOTUNE_CACHE_MUTEX);
+  std::string path = get_autotune_cache_path();
+  std::filesystem::path dir = std::filesystem::path(path).parent_path();
+  if (!dir.empty()) {
+    std::filesystem::create_directories(dir);
+  }
+
+  // Processes updating the cache at the same time would otherwise drop each
+  // other's entries.
+  FileLock lock(path + ".lock");
+  std::map<std::string, KernelConfig> cfgs = read_tuned_configs(path);
+  cfgs[key] = cfg;
+
+  // Write to a temporary file first so that readers, which don't take the
+  // lock, never see a partial cache.
+  std::string tmp_path = make_tmp_cache_path(path);
+  {
+    std::ofstream f(tmp_path, std::ios::trunc);
+    for (const auto& pair : cfgs) {
+      f << pair.first << " " << pair.second.block_dim << " " << pair.second.specialize_shapes << std::endl;
+    }
+  }
+  std::filesystem::rename(tmp_path, path);
+}
+
+} // namespace ticpp
@@ -1,33 +1,187 @@
+#include <algorithm>
+#include <atomic>
+#include <filesystem>
 #include <fstream>
+#include <future>
+#include <map>
+#include <mutex>
+#include <random>
 #include "ticpp/codegen.hpp"
 
 namespace ticpp {
 
-void dump_aot_script(const std::string& script) {
+std::string make_aot_scratch_dir() {
+  static std::atomic<uint64_t> counter_ { 0 };
+
+  // Every compilation gets its own scratch directory so that concurrent
+  // instantiations never share `app.py` or the saved module.
+  std::random_device rd;
+  std::filesystem::path dir = std::filesystem::temp_directory_path() /
+    ("ticpp-" + std::to_string(rd()) + "-" + std::to_string(counter_++));
+  std::filesystem::create_directories(dir);
+  return dir.string();
+}
+void dump_aot_script(const std::string& scratch_dir, const std::string& script) {
+  std::filesystem::path dir(scratch_dir);
+  std::filesystem::path script_path = dir / "app.py";
   {
-    std::fstream f("app.py", std::ios::out | std::ios::trunc);
+    std::fstream f(script_path, std::ios::out | std::ios::trunc);
     f << script << std::endl;
   }
-  system("TI_OFFLINE_CACHE=0 /Users/penguinliong/opt/anaconda3/bin/python3 app.py");
+  // Don't rely on Taichi to create the output directory.
+  std::filesystem::create_directories(load_aot_module_path(scratch_dir));
+
+  // `TICPP_PYTHON` allows build scripts to pick the interpreter.
+  const char* python = std::getenv("TICPP_PYTHON");
+  if (python == nullptr) {
+    python = "/Users/penguinliong/opt/anaconda3/bin/python3";
+  }
+  std::string cmd = std::string("TI_OFFLINE_CACHE=0 ") + python + " \"" +
+    script_path.string() + "\" \"" + load_aot_module_path(scratch_dir) + "\"";
+  if (system(cmd.c_str()) != 0) {
+    throw std::runtime_error("failed to compile aot module in " + scratch_dir);
+  }
+}
+void print_script(const std::string& script) {
+  const char* enabled = std::getenv("TICPP_PRINT_SCRIPT");
+  if (enabled == nullptr || std::string(enabled) == "0") { return; }
+
+  // Written at once so that concurrent instantiations don't interleave.
+  std::stringstream ss;
+  ss << script << std::endl;
+  std::cout << ss.str() << std::flush;
+}
+
+std::string load_aot_module_path(const std::string& scratch_dir) {
+  return (std::filesystem::path(scratch_dir) / "module").string();
+}
+void remove_aot_artifact(const std::string& scratch_dir) {
+  std::error_code ec;
+  std::filesystem::remove_all(scratch_dir, ec);
+}
+
+
+
+// Modules are shared by every kernel that generated the same script on the
+// same runtime. Entries are weak so a module goes away with its last kernel;
+// expired entries are swept on insert so keys don't pile up.
+template<typename TKey, typename TValue>
+static void erase_expired(std::map<TKey, std::weak_ptr<TValue>>& cache) {
+  for (auto it = cache.begin(); it != cache.end();) {
+    if (it->second.expired()) {
+      it = cache.erase(it);
+    } else {
+      ++it;
+    }
+  }
 }
-std::string load_aot_module_path() {
-  std::string path;
+
+struct AotModuleCacheKey {
+  TiRuntime runtime;
+  std::string script;
+
+  bool operator<(const AotModuleCacheKey& b) const {
+    return runtime != b.runtime ? runtime < b.runtime : script < b.script;
+  }
+};
+typedef std::shared_future<std::shared_ptr<ti::AotModule>> AotModuleFuture;
+
+static std::mutex AOT_MODULE_CACHE_MUTEX;
+static std::map<AotModuleCacheKey, std::weak_ptr<ti::AotModule>> AOT_MODULE_CACHE;
+static std::map<AotModuleCacheKey, AotModuleFuture> AOT_MODULE_INFLIGHT;
+
+std::shared_ptr<ti::AotModule> compile_aot_module(
+  ti::Runtime& runtime,
+  const std::string& script
+) {
+  AotModuleCacheKey key { runtime.runtime(), script };
+  std::promise<std::shared_ptr<ti::AotModule>> promise;
   {
-    std::fstream f("temp_dir", std::ios::in);
-    f >> path;
+    std::unique_lock<std::mutex> lock(AOT_MODULE_CACHE_MUTEX);
+
+    auto it = AOT_MODULE_CACHE.find(key);
+    if (it != AOT_MODULE_CACHE.end()) {
+      std::shared_ptr<ti::AotModule> mod = it->second.lock();
+      if (mod != nullptr) { return mod; }
+      AOT_MODULE_CACHE.erase(it);
+    }
+
+    // Someone else is compiling the same kernel; wait for their result.
+    auto it2 = AOT_MODULE_INFLIGHT.find(key);
+    if (it2 != AOT_MODULE_INFLIGHT.end()) {
+      AotModuleFuture future = it2->second;
+      lock.unlock();
+      return future.get();
+    }
+
+    AOT_MODULE_INFLIGHT.emplace(key, promise.get_future().share());
+  }
+
+  std::shared_ptr<ti::AotModule> mod;
+  std::string scratch_dir = make_aot_scratch_dir();
+  try {
+    dump_aot_script(scratch_dir, script);
+    mod = std::make_shared<ti::AotModule>(
+      runtime.load_aot_module(load_aot_module_path(scratch_dir)));
+  } catch (...) {
+    remove_aot_artifact(scratch_dir);
+    std::lock_guard<std::mutex> guard(AOT_MODULE_CACHE_MUTEX);
+    promise.set_exception(std::current_exception());
+    AOT_MODULE_INFLIGHT.erase(key);
+    throw;
   }
-  return path;
+  remove_aot_artifact(scratch_dir);
+
+  std::lock_guard<std::mutex> guard(AOT_MODULE_CACHE_MUTEX);
+  promise.set_value(mod);
+  erase_expired(AOT_MODULE_CACHE);
+  AOT_MODULE_CACHE[key] = mod;
+  AOT_MODULE_INFLIGHT.erase(key);
+  return mod;
 }
-void remove_aot_artifact(const std::string& temp_dir) {
-  system("rm temp_dir");
-  system("rm app.py");
-  system(("rm -r " + temp_dir).c_str());
+
+struct StaticModuleCacheKey {
+  TiRuntime runtime;
+  std::string key;
+
+  bool operator<(const StaticModuleCacheKey& b) const {
+    return runtime != b.runtime ? runtime < b.runtime : key < b.key;
+  }
+};
+
+static std::mutex STATIC_MODULE_CACHE_MUTEX;
+static std::map<StaticModuleCacheKey, std::weak_ptr<ti::AotModule>> STATIC_MODULE_CACHE;
+
+std::shared_ptr<ti::AotModule> get_or_compile_static_module(
+  ti::Runtime& runtime,
+  const std::string& key,
+  const std::function<std::shared_ptr<ti::AotModule>()>& compile
+) {
+  StaticModuleCacheKey key2 { runtime.runtime(), key };
+  {
+    std::lock_guard<std::mutex> guard(STATIC_MODULE_CACHE_MUTEX);
+    auto it = STATIC_MODULE_CACHE.find(key2);
+    if (it != STATIC_MODULE_CACHE.end()) {
+      std::shared_ptr<ti::AotModule> mod = it->second.lock();
+      if (mod != nullptr) { return mod; }
+    }
+  }
+
+  // Concurrent misses are deduplicated by `compile_aot_module`.
+  std::shared_ptr<ti::AotModule> mod = compile();
+
+  std::lock_guard<std::mutex> guard(STATIC_MODULE_CACHE_MUTEX);
+  erase_expired(STATIC_MODULE_CACHE);
+  STATIC_MODULE_CACHE[key2] = mod;
+  return mod;
 }
 
 const char* arch2str(TiArch arch) {
   switch (arch) {
   case TI_ARCH_VULKAN:
     return "ti.vulkan";
+  case TI_ARCH_X64:
+    return "ti.x64";
   default:
     assert(false);
   }
@@ -66,13 +220,10 @@ const char* dtype2str(TiDataType dtype) {
 
 std::string shape2str(const TiNdShape& shape) {
   std::stringstream ss;
+  // An empty shape is `()`, i.e., scalar elements.
   ss << "(";
-  if (shape.dim_count != 0) {
-    for (uint32_t i = 0; i < shape.dim_count; ++i) {
-      ss << shape.dims[i] << ", ";
-    }
-  } else {
-    ss << ",";
+  for (uint32_t i = 0; i < shape.dim_count; ++i) {
+    ss << shape.dims[i] << ", ";
   }
   ss << ")";
   return ss.str();
@@ -92,6 +243,10 @@ std::string build_symbols(const std::vector<NamedArgumentRef>& args) {
     case TI_ARGUMENT_TYPE_F32:
       ss << "ti.graph.Arg(ti.graph.ArgKind.SCALAR, '" << arg.name << "', ti.f32)";
       break;
+    case TI_ARGUMENT_TYPE_SCALAR:
+      ss << "ti.graph.Arg(ti.graph.ArgKind.SCALAR, '" << arg.name << "', "
+        << dtype2str(arg.argument.value.scalar.type) << ")";
+      break;
     case TI_ARGUMENT_TYPE_NDARRAY:
       ss << "ti.graph.Arg(ti.graph.ArgKind.NDARRAY, "
         << "'" << arg.name << "', "
@@ -121,6 +276,9 @@ std::string build_params(const std::vector<NamedArgumentRef>& args) {
     case TI_ARGUMENT_TYPE_F32:
       ss << "ti.f32";
       break;
+    case TI_ARGUMENT_TYPE_SCALAR:
+      ss << dtype2str(arg.argument.value.scalar.type);
+      break;
     case TI_ARGUMENT_TYPE_NDARRAY:
       ss << "ti.types.ndarray(field_dim=" << arg.argument.value.ndarray.shape.dim_count << ")";
       break;
@@ -151,17 +309,65 @@ std::string build_code(const std::vector<StmtRef>& stmts) {
   return ss.str();
 }
 
-std::string composite_python_script(
-  TiArch arch,
-  const ParseResult& itm
-) {
+std::string build_fields(TiArch arch, const std::vector<FieldDeclRef>& fields) {
   std::stringstream ss;
-  ss << R"(
-import tempfile
-import taichi as ti
+  for (const FieldDeclRef& field : fields) {
+    if (field->is_sparse() && arch != TI_ARCH_X64) {
+      throw std::runtime_error("sparse field " + field->name + " requires an LLVM-based arch");
+    }
 
-ti.init()" << arch2str(arch) << R"(, offline_cache=False)
+    ss << field->name << " = ";
+    if (field->elem_shape.empty()) {
+      ss << "ti.field(" << dtype2str(field->dtype) << ")";
+    } else {
+      assert(field->elem_shape.size() == 1);
+      ss << "ti.Vector.field(" << field->elem_shape.at(0) << ", " << dtype2str(field->dtype) << ")";
+    }
+    ss << std::endl;
+
+    ss << "ti.root";
+    for (const SNodeDesc& snode : field->snodes) {
+      switch (snode.type) {
+      case SNODE_TYPE_DENSE:
+        ss << ".dense(";
+        break;
+      case SNODE_TYPE_POINTER:
+        ss << ".pointer(";
+        break;
+      case SNODE_TYPE_BITMASKED:
+        ss << ".bitmasked(";
+        break;
+      case SNODE_TYPE_DYNAMIC:
+        ss << ".dynamic(";
+        break;
+      default:
+        assert(false);
+      }
+
+      ss << "ti.axes(";
+      for (uint32_t axis : snode.axes) {
+        ss << axis << ", ";
+      }
+      ss << "), ";
+      if (snode.type == SNODE_TYPE_DYNAMIC) {
+        ss << snode.shape.at(0) << ", chunk_size=" << snode.chunk_size;
+      } else {
+        ss << "(";
+        for (uint32_t extent : snode.shape) {
+          ss << extent << ", ";
+        }
+        ss << ")";
+      }
+      ss << ")";
+    }
+    ss << ".place(" << field->name << ")" << std::endl;
+  }
+  return ss.str();
+}
 
+std::string build_graph(const std::string& name, const ParseResult& itm) {
+  std::stringstream ss;
+  ss << R"(
 )" << build_symbols(itm.args) << R"(
 
 @ti.kernel
@@ -171,13 +377,59 @@ def f()" << build_params(itm.args) << R"():
 g_builder = ti.graph.GraphBuilder()
 g_builder.dispatch(f,)" << build_args(itm.args) << R"()
 graph = g_builder.compile()
+mod.add_graph(')" << name << R"(', graph)
+)";
+  return ss.str();
+}
+
+std::string composite_python_bundle_script(
+  TiArch arch,
+  const std::vector<std::pair<std::string, ParseResult>>& itms
+) {
+  // Fields are declared once and shared by all kernels in the module.
+  std::vector<FieldDeclRef> fields;
+  for (const auto& itm : itms) {
+    for (const FieldDeclRef& field : itm.second.fields) {
+      if (std::find(fields.begin(), fields.end(), field) == fields.end()) {
+        fields.emplace_back(field);
+      }
+    }
+  }
+
+  std::stringstream ss;
+  ss << R"(
+import sys
+import taichi as ti
+
+ti.init()" << arch2str(arch) << R"(, offline_cache=False)
+
+)" << build_fields(arch, fields) << R"(
+mod = ti.aot.Module()" << arch2str(arch) << R"()
+)";
+  for (const auto& itm : itms) {
+    ss << build_graph(itm.first, itm.second);
+  }
+  ss << R"(
+mod.save(sys.argv[1], '')
+)";
+  return ss.str();
+}
+
+std::string composite_python_script(
+  TiArch arch,
+  const ParseResult& itm
+) {
+  std::stringstream ss;
+  ss << R"(
+import sys
+import taichi as ti
+
+ti.init()" << arch2str(arch) << R"(, offline_cache=False)
 
+)" << build_fields(arch, itm.fields) << R"(
 mod = ti.aot.Module()" << arch2str(arch) << R"()
-mod.add_graph('g', graph)
-temp_dir = tempfile.mkdtemp()
-mod.save(temp_dir, '')
-with open("temp_dir", "w") as f:
-    f.write(temp_dir)
+)" << build_graph("g", itm) << R"(
+mod.save(sys.argv[1], '')
 )";
   return ss.str();
 }
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <map>
+#include <thread>
+#include "ticpp/event.hpp"
+
+namespace ticpp {
+
+Timeline::Timeline(TiArch arch, TiRuntime runtime) :
+  arch_(arch), runtime_(runtime), query_(create_vulkan_event_query(arch, runtime)) {}
+Timeline::~Timeline() {
+  // Every `DeviceEvent` holds the timeline, so all events are pooled by now.
+  // Pending work may still refer to them.
+  if (nretire_ < nsubmit_) {
+    ti_wait(runtime_);
+  }
+  for (const DeviceEvent& event : pool_) {
+    ti_destroy_event(event.event_);
+  }
+}
+
+void Timeline::wait_on_device(const DeviceEventRef& event) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  ti_wait_event(runtime_, event->event_);
+  // Retires with the next signal.
+  event->last_use_ = nsubmit_ + 1;
+}
+DeviceEventRef Timeline::signal() {
+  std::lock_guard<std::mutex> guard(mutex_);
+  DeviceEvent event {};
+  event.event_ = acquire_event();
+  event.seq_ = ++nsubmit_;
+  event.last_use_ = event.seq_;
+  ti_signal_event(runtime_, event.event_);
+  ti_submit(runtime_);
+
+  TimelineRef self = shared_from_this();
+  return DeviceEventRef(new DeviceEvent(event), [self](DeviceEvent* x) {
+    self->release_event(x);
+  });
+}
+void Timeline::wait(const DeviceEvent& event) {
+  if (query_ == nullptr) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (event.seq_ <= nretire_) { return; }
+    }
+    wait_all();
+    return;
+  }
+
+  for (;;) {
+    {
+      std::lock_guard<std::mutex> guard(mutex_);
+      if (event.seq_ <= nretire_) { return; }
+      if (is_vulkan_event_set(*query_, event.event_)) {
+        // Events are signaled after all work submitted before them.
+        nretire_ = std::max(nretire_, event.seq_);
+        return;
+      }
+    }
+    std::this_thread::yield();
+  }
+}
+void Timeline::wait_all() {
+  uint64_t target;
+  {
+    std::lock_guard<std::mutex> guard(mutex_);
+    target = nsubmit_;
+  }
+
+  // Don't block launches from other threads while draining.
+  ti_wait(runtime_);
+
+  std::lock_guard<std::mutex> guard(mutex_);
+  nretire_ = std::max(nretire_, target);
+}
+
+TiEvent Timeline::acquire_event() {
+  auto is_reusable = [this](const DeviceEvent& x) {
+    return x.last_use_ <= nretire_;
+  };
+  auto it = std::find_if(pool_.begin(), pool_.end(), is_reusable);
+  if (it == pool_.end()) {
+    poll_pool();
+    it = std::find_if(pool_.begin(), pool_.end(), is_reusable);
+  }
+  if (it == pool_.end()) {
+    return ti_create_event(runtime_);
+  }
+
+  // The last signal and every wait on it have completed.
+  TiEvent out = it->event_;
+  pool_.erase(it);
+  ti_reset_event(runtime_, out);
+  return out;
+}
+void Timeline::poll_pool() {
+  if (query_ == nullptr) { return; }
+  // Pooled events keep their last signal until reused, and the latest one
+  // observed signaled retires everything submitted before it.
+  for (const DeviceEvent& event : pool_) {
+    if (event.seq_ > nretire_ && is_vulkan_event_set(*query_, event.event_)) {
+      nretire_ = event.seq_;
+    }
+  }
+}
+void Timeline::release_event(DeviceEvent* event) {
+  std::lock_guard<std::mutex> guard(mutex_);
+  pool_.emplace_back(*event);
+  delete event;
+}
+
+LaunchEvent copy_memory_after(
+  const TimelineRef& timeline,
+  const std::vector<LaunchEvent>& deps,
+  TiMemory dst,
+  TiMemory src,
+  uint64_t size
+) {
+  wait_events(timeline, deps);
+
+  TiMemorySlice dst_slice {};
+  dst_slice.memory = dst;
+  dst_slice.size = size;
+  TiMemorySlice src_slice {};
+  src_slice.memory = src;
+  src_slice.size = size;
+  ti_copy_memory_device_to_device(timeline->runtime_, &dst_slice, &src_slice);
+
+  LaunchEvent out {};
+  out.timeline_ = timeline;
+  out.event_ = timeline->signal();
+  return out;
+}
+
+static std::mutex TIMELINES_MUTEX;
+static std::map<TiRuntime, std::weak_ptr<Timeline>> TIMELINES;
+
+TimelineRef get_timeline(TiArch arch, TiRuntime runtime) {
+  std::lock_guard<std::mutex> guard(TIMELINES_MUTEX);
+  TimelineRef out = TIMELINES[runtime].lock();
+  if (out == nullptr) {
+    // Sweep timelines of destroyed runtimes.
+    for (auto it = TIMELINES.begin(); it != TIMELINES.end();) {
+      if (it->second.expired()) {
+        it = TIMELINES.erase(it);
+      } else {
+        ++it;
+      }
+    }
+    out = std::make_shared<Timeline>(arch, runtime);
+    TIMELINES[runtime] = out;
+  }
+  return out;
+}
+
+} // namespace ticpp
@@ -0,0 +1,68 @@
+#include "ticpp/kernel_bundle.hpp"
+
+namespace ticpp {
+
+void KernelBundle::add_host_access(const Field& field) {
+  assert(mod_ == nullptr);
+  FieldDeclRef decl = field.decl_;
+  TiNdArray sig = ndarray_sig(decl->dtype, field_shape(*decl), decl->elem_shape);
+
+  // Element types are the same, so copy expressions regardless of the type.
+  RegisteredKernel read {};
+  read.name = "read_" + decl->name;
+  read.trace = [decl, sig]() {
+    std::function<void(NdArrayValue)> fn = [decl](NdArrayValue dst) {
+      FieldValue fld(Field { decl });
+      TICPP_FOR(idxs, dst) {
+        StoreStmt::create(dst[idxs].expr_, fld[idxs].expr_)->commit();
+      };
+    };
+    return run_trace(fn, sig);
+  };
+  kernels_.emplace_back(std::move(read));
+
+  RegisteredKernel write {};
+  write.name = "write_" + decl->name;
+  write.trace = [decl, sig]() {
+    std::function<void(NdArrayValue)> fn = [decl](NdArrayValue src) {
+      FieldValue fld(Field { decl });
+      TICPP_FOR(idxs, src) {
+        StoreStmt::create(fld[idxs].expr_, src[idxs].expr_)->commit();
+      };
+    };
+    return run_trace(fn, sig);
+  };
+  kernels_.emplace_back(std::move(write));
+}
+
+void KernelBundle::build() {
+  std::vector<std::pair<std::string, ParseResult>> itms;
+  for (RegisteredKernel& kernel : kernels_) {
+    ParseResult itm = kernel.trace();
+    print_pass_stats(PassManager::create_default().run(itm));
+    itms.emplace_back(kernel.name, std::move(itm));
+  }
+
+  std::string script = composite_python_bundle_script(runtime_.arch(), itms);
+  print_script(script);
+  mod_ = compile_aot_module(runtime_, script);
+}
+
+void KernelBundle::read_field(const Field& field, const TiNdArray& dst) {
+  if (mod_ == nullptr) {
+    throw std::runtime_error("kernel bundle is not built");
+  }
+  ti::ComputeGraph cgraph = mod_->get_compute_graph("read_" + field.decl_->name);
+  cgraph["_0"] = dst;
+  cgraph.launch();
+}
+void KernelBundle::write_field(const Field& field, const TiNdArray& src) {
+  if (mod_ == nullptr) {
+    throw std::runtime_error("kernel bundle is not built");
+  }
+  ti::ComputeGraph cgraph = mod_->get_compute_graph("write_" + field.decl_->name);
+  cgraph["_0"] = src;
+  cgraph.launch();
+}
+
+} // namespace ticpp
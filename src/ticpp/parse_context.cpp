@@ -1,19 +1,40 @@
+#include <algorithm>
 #include "ticpp/parse_context.hpp"
 #include "ticpp/stmt.hpp"
 
 namespace ticpp {
 
+std::string ParseContext::alloc_itervar_name() {
+  return "it_" + std::to_string(itervar_counter++);
+}
+std::string ParseContext::alloc_local_name() {
+  return "var_" + std::to_string(local_counter++);
+}
+void ParseContext::reg_field(const FieldDeclRef& field) {
+  if (std::find(fields.begin(), fields.end(), field) == fields.end()) {
+    fields.emplace_back(field);
+  }
+}
 void ParseContext::commit_stmt(const StmtRef& stmt) {
   frames.back().stmts.emplace_back(stmt);
 }
 
 void ParseContext::start() {
+  if (frames.empty()) {
+    itervar_counter = 0;
+    local_counter = 0;
+    fields.clear();
+  }
   frames.emplace_back();
 }
 ParseResult ParseContext::stop() {
   ParseResult out {};
   out.args = std::move(frames.back().args);
   out.stmts = std::move(frames.back().stmts);
+  if (frames.size() == 1) {
+    out.fields = std::move(fields);
+    fields.clear();
+  }
 
   frames.pop_back();
   return out;
@@ -0,0 +1,497 @@
+#include <map>
+#include <set>
+#include "ticpp/field.hpp"
+#include "ticpp/pass.hpp"
+
+namespace ticpp {
+
+ExprRef map_expr(const ExprRef& expr, const ExprMapper& f) {
+  ExprRef out = expr->map_children(f);
+  return out != nullptr ? out : expr;
+}
+void map_block_exprs(std::vector<StmtRef>& stmts, const ExprMapper& f) {
+  for (const StmtRef& stmt : stmts) {
+    stmt->map_exprs(f);
+    for (std::vector<StmtRef>* block : stmt->blocks()) {
+      map_block_exprs(*block, f);
+    }
+  }
+}
+
+// Expressions are compared structurally by their emitted code.
+std::string expr2str(const ExprRef& expr) {
+  PythonScriptWriter ss;
+  expr->to_string(ss);
+  return ss.str();
+}
+
+bool is_int_literal(const ExprRef& expr) {
+  const IntImmExpr* imm = dynamic_cast<const IntImmExpr*>(expr.get());
+  return imm != nullptr && imm->arg_name_.empty();
+}
+bool is_float_literal(const ExprRef& expr) {
+  const FloatImmExpr* imm = dynamic_cast<const FloatImmExpr*>(expr.get());
+  return imm != nullptr && imm->arg_name_.empty();
+}
+bool is_literal(const ExprRef& expr) {
+  return is_int_literal(expr) || is_float_literal(expr);
+}
+
+// Whether the expression reads from any ndarray or field.
+bool has_load(const ExprRef& expr) {
+  if (dynamic_cast<const SNodeOpExpr*>(expr.get()) != nullptr) {
+    return true;
+  }
+  const IndexExpr* index = dynamic_cast<const IndexExpr*>(expr.get());
+  if (index != nullptr && (
+    dynamic_cast<const NdArrayAllocExpr*>(index->alloc_.get()) != nullptr ||
+    dynamic_cast<const FieldExpr*>(index->alloc_.get()) != nullptr
+  )) {
+    return true;
+  }
+  bool out = false;
+  expr->for_each_child([&](const ExprRef& x) { out = out || has_load(x); });
+  return out;
+}
+
+
+
+ExprRef fold_expr(const ExprRef& expr, uint32_t& nrewrite) {
+  ExprRef out = map_expr(expr, [&](const ExprRef& x) { return fold_expr(x, nrewrite); });
+
+  if (dynamic_cast<const AddExpr*>(out.get()) != nullptr ||
+    dynamic_cast<const SubExpr*>(out.get()) != nullptr
+  ) {
+    ExprRef a, b;
+    out->for_each_child([&](const ExprRef& x) { (a == nullptr ? a : b) = x; });
+    if (is_int_literal(a) && is_int_literal(b)) {
+      ++nrewrite;
+      return IntImmExpr::create(out->evaluate_i32());
+    } else if (is_literal(a) && is_literal(b)) {
+      ++nrewrite;
+      return FloatImmExpr::create(out->evaluate_f32());
+    }
+  } else if (const TypeCastExpr* cast = dynamic_cast<const TypeCastExpr*>(out.get())) {
+    if (cast->target_ty_ == "ti.i32" && is_int_literal(cast->expr_)) {
+      ++nrewrite;
+      return cast->expr_;
+    } else if (cast->target_ty_ == "ti.i32" && is_float_literal(cast->expr_)) {
+      // Only fold values that fit in i32; NaN and out-of-range values are
+      // left for Taichi to convert.
+      float value = cast->expr_->evaluate_f32();
+      if (value >= -2147483648.0f && value < 2147483648.0f) {
+        ++nrewrite;
+        return IntImmExpr::create((int32_t)value);
+      }
+    } else if (cast->target_ty_ == "ti.f32" && is_literal(cast->expr_)) {
+      ++nrewrite;
+      return FloatImmExpr::create(cast->expr_->evaluate_f32());
+    }
+  }
+  return out;
+}
+
+uint32_t ConstantFoldingPass::run(ParseResult& itm) {
+  uint32_t nrewrite = 0;
+  map_block_exprs(itm.stmts, [&](const ExprRef& x) { return fold_expr(x, nrewrite); });
+  return nrewrite;
+}
+
+
+
+uint32_t eliminate_dead_stores(std::vector<StmtRef>& stmts) {
+  uint32_t nrewrite = 0;
+  for (const StmtRef& stmt : stmts) {
+    for (std::vector<StmtRef>* block : stmt->blocks()) {
+      nrewrite += eliminate_dead_stores(*block);
+    }
+  }
+
+  // Whether the store reads ndarrays other than writing to its destination.
+  auto store_has_load = [](const StoreStmt& store) {
+    const IndexExpr* dst = dynamic_cast<const IndexExpr*>(store.dst_.get());
+    return has_load(store.value_) || dst == nullptr || has_load(dst->index_);
+  };
+
+  std::vector<StmtRef> out;
+  for (size_t i = 0; i < stmts.size(); ++i) {
+    const StoreStmt* store = dynamic_cast<const StoreStmt*>(stmts.at(i).get());
+    bool is_dead = false;
+    if (store != nullptr && !store_has_load(*store)) {
+      std::string dst = expr2str(store->dst_);
+      // Any other kind of statement in between is conservatively treated as
+      // a read.
+      for (size_t j = i + 1; j < stmts.size(); ++j) {
+        const StoreStmt* store2 = dynamic_cast<const StoreStmt*>(stmts.at(j).get());
+        if (store2 == nullptr || store_has_load(*store2)) { break; }
+        if (expr2str(store2->dst_) == dst) {
+          is_dead = true;
+          break;
+        }
+      }
+    }
+
+    if (is_dead) {
+      ++nrewrite;
+    } else {
+      out.emplace_back(stmts.at(i));
+    }
+  }
+  stmts = std::move(out);
+  return nrewrite;
+}
+
+uint32_t DeadStoreEliminationPass::run(ParseResult& itm) {
+  return eliminate_dead_stores(itm.stmts);
+}
+
+
+
+// Index of a loop statement, or `nullptr`.
+ExprRef loop_index(const StmtRef& stmt) {
+  if (const ForStmt* for_stmt = dynamic_cast<const ForStmt*>(stmt.get())) {
+    return for_stmt->index_;
+  } else if (const RangeForStmt* range_for = dynamic_cast<const RangeForStmt*>(stmt.get())) {
+    return range_for->index_;
+  }
+  return nullptr;
+}
+// Names of loop indices and locals bound in `stmts`.
+void collect_bound_names(const std::vector<StmtRef>& stmts, std::set<std::string>& out) {
+  for (const StmtRef& stmt : stmts) {
+    if (const DeclareStmt* decl = dynamic_cast<const DeclareStmt*>(stmt.get())) {
+      out.insert(expr2str(decl->var_));
+    }
+    ExprRef index = loop_index(stmt);
+    if (index != nullptr) {
+      out.insert(expr2str(index));
+    }
+    for (std::vector<StmtRef>* block : stmt->blocks()) {
+      collect_bound_names(*block, out);
+    }
+  }
+}
+
+// Whether the expression is invariant in a loop binding `bound`. Indices of
+// enclosing loops are invariant.
+bool is_loop_invariant(const ExprRef& expr, const std::set<std::string>& bound) {
+  if (has_load(expr)) {
+    return false;
+  }
+  if (dynamic_cast<const IterVarExpr*>(expr.get()) != nullptr ||
+    dynamic_cast<const LocalVarExpr*>(expr.get()) != nullptr
+  ) {
+    const LocalVarExpr* var = dynamic_cast<const LocalVarExpr*>(expr.get());
+    if (var != nullptr && var->is_mutable_) {
+      return false;
+    }
+    return bound.find(expr2str(expr)) == bound.end();
+  }
+  bool out = true;
+  expr->for_each_child([&](const ExprRef& x) { out = out && is_loop_invariant(x, bound); });
+  return out;
+}
+bool is_worth_hoisting(const ExprRef& expr) {
+  // Vectors are not hoisted as a whole, but their elements can be.
+  if (dynamic_cast<const VectorExpr*>(expr.get()) != nullptr ||
+    dynamic_cast<const TiVectorExpr*>(expr.get()) != nullptr
+  ) {
+    return false;
+  }
+  // Nor are loop index components, which are free to read.
+  const IndexExpr* index = dynamic_cast<const IndexExpr*>(expr.get());
+  if (index != nullptr && dynamic_cast<const IterVarExpr*>(index->alloc_.get()) != nullptr) {
+    return false;
+  }
+  bool has_child = false;
+  expr->for_each_child([&](const ExprRef& x) { has_child = true; });
+  return has_child;
+}
+
+struct LoopInvariantHoister {
+  std::set<std::string> bound;
+  uint32_t* nvar;
+  std::vector<StmtRef> decls;
+  std::map<std::string, ExprRef> vars;
+
+  ExprRef hoist(const ExprRef& expr) {
+    if (!is_loop_invariant(expr, bound) || !is_worth_hoisting(expr)) {
+      return map_expr(expr, [&](const ExprRef& x) { return hoist(x); });
+    }
+
+    std::string key = expr2str(expr);
+    auto it = vars.find(key);
+    if (it != vars.end()) {
+      return it->second;
+    }
+    ExprRef var = LocalVarExpr::create("licm_" + std::to_string((*nvar)++));
+    decls.emplace_back(DeclareStmt::create(var, expr));
+    vars.emplace(key, var);
+    return var;
+  }
+};
+
+// Hoist invariants of the loops in `stmts` right before each loop, innermost
+// loops first so that invariants move out as far as they can.
+uint32_t hoist_loop_invariants(std::vector<StmtRef>& stmts, uint32_t& nvar) {
+  uint32_t nrewrite = 0;
+  std::vector<StmtRef> out;
+  for (const StmtRef& stmt : stmts) {
+    for (std::vector<StmtRef>* block : stmt->blocks()) {
+      nrewrite += hoist_loop_invariants(*block, nvar);
+    }
+
+    ExprRef index = loop_index(stmt);
+    if (index != nullptr) {
+      LoopInvariantHoister hoister {};
+      hoister.nvar = &nvar;
+      hoister.bound.insert(expr2str(index));
+      for (std::vector<StmtRef>* block : stmt->blocks()) {
+        collect_bound_names(*block, hoister.bound);
+      }
+      for (std::vector<StmtRef>* block : stmt->blocks()) {
+        map_block_exprs(*block, [&](const ExprRef& x) { return hoister.hoist(x); });
+      }
+      out.insert(out.end(), hoister.decls.begin(), hoister.decls.end());
+      nrewrite += hoister.decls.size();
+    }
+    out.emplace_back(stmt);
+  }
+  stmts = std::move(out);
+  return nrewrite;
+}
+
+uint32_t LoopInvariantCodeMotionPass::run(ParseResult& itm) {
+  // Nothing is hoisted out of kernel-level loops. Kernel-scope locals read by
+  // a parallel loop cost Taichi an extra serial task and a global temporary,
+  // which is slower than recomputing cheap arithmetic in each thread.
+  uint32_t nvar = 0;
+  uint32_t nrewrite = 0;
+  for (const StmtRef& stmt : itm.stmts) {
+    for (std::vector<StmtRef>* block : stmt->blocks()) {
+      nrewrite += hoist_loop_invariants(*block, nvar);
+    }
+  }
+  return nrewrite;
+}
+
+
+
+uint32_t specialize_shapes(std::vector<StmtRef>& stmts) {
+  uint32_t nrewrite = 0;
+  for (const StmtRef& stmt : stmts) {
+    if (ForStmt* for_stmt = dynamic_cast<ForStmt*>(stmt.get())) {
+      const NdArrayAllocExpr* alloc = dynamic_cast<const NdArrayAllocExpr*>(for_stmt->range_.get());
+      if (alloc != nullptr) {
+        std::vector<ExprRef> extents;
+        for (uint32_t i = 0; i < alloc->ndarray_.shape.dim_count; ++i) {
+          extents.emplace_back(IntImmExpr::create((int32_t)alloc->ndarray_.shape.dims[i]));
+        }
+        for_stmt->range_ = NdRangeExpr::create(std::move(extents));
+        ++nrewrite;
+      }
+    }
+    for (std::vector<StmtRef>* block : stmt->blocks()) {
+      nrewrite += specialize_shapes(*block);
+    }
+  }
+  return nrewrite;
+}
+
+ExprRef specialize_shape_expr(const ExprRef& expr, uint32_t& nrewrite) {
+  if (const NdArrayShapeExpr* shape = dynamic_cast<const NdArrayShapeExpr*>(expr.get())) {
+    const NdArrayAllocExpr* alloc = dynamic_cast<const NdArrayAllocExpr*>(shape->alloc_.get());
+    if (alloc != nullptr && shape->axis_ < alloc->ndarray_.shape.dim_count) {
+      ++nrewrite;
+      return IntImmExpr::create((int32_t)alloc->ndarray_.shape.dims[shape->axis_]);
+    }
+  }
+  return map_expr(expr, [&](const ExprRef& x) { return specialize_shape_expr(x, nrewrite); });
+}
+
+uint32_t ShapeSpecializationPass::run(ParseResult& itm) {
+  uint32_t nrewrite = specialize_shapes(itm.stmts);
+  // Extents of lowered SoA loops.
+  map_block_exprs(itm.stmts, [&](const ExprRef& x) { return specialize_shape_expr(x, nrewrite); });
+  return nrewrite;
+}
+
+
+
+const NdArrayAllocExpr* as_soa_alloc(const ExprRef& expr) {
+  const NdArrayAllocExpr* alloc = dynamic_cast<const NdArrayAllocExpr*>(expr.get());
+  return alloc != nullptr && alloc->layout_ == NDARRAY_LAYOUT_SOA ? alloc : nullptr;
+}
+// `arr[i, idx[0], idx[1], ...]` of a SoA ndarray `arr`.
+ExprRef soa_component(const ExprRef& alloc, const ExprRef& idx, int32_t i) {
+  const NdArrayAllocExpr* alloc2 = as_soa_alloc(alloc);
+  std::vector<ExprRef> idxs { IntImmExpr::create(i) };
+  if (const VectorExpr* vec = dynamic_cast<const VectorExpr*>(idx.get())) {
+    idxs.insert(idxs.end(), vec->elems_.begin(), vec->elems_.end());
+  } else {
+    // A grouped loop index over the spatial dimensions.
+    for (uint32_t j = 1; j < alloc2->ndarray_.shape.dim_count; ++j) {
+      idxs.emplace_back(IndexExpr::create(idx, IntImmExpr::create(j - 1)));
+    }
+  }
+  return IndexExpr::create(alloc, VectorExpr::create(std::move(idxs)));
+}
+int32_t soa_component_count(const ExprRef& alloc) {
+  return (int32_t)as_soa_alloc(alloc)->ndarray_.shape.dims[0];
+}
+
+ExprRef lower_soa_expr(const ExprRef& expr, uint32_t& nrewrite) {
+  if (const IndexExpr* index = dynamic_cast<const IndexExpr*>(expr.get())) {
+    // Component of an element, `arr[idx][i]`.
+    const IndexExpr* elem = dynamic_cast<const IndexExpr*>(index->alloc_.get());
+    if (elem != nullptr && as_soa_alloc(elem->alloc_) != nullptr && is_int_literal(index->index_)) {
+      ++nrewrite;
+      return soa_component(elem->alloc_, lower_soa_expr(elem->index_, nrewrite),
+        index->index_->evaluate_i32());
+    }
+    // Whole element, `arr[idx]`.
+    if (as_soa_alloc(index->alloc_) != nullptr) {
+      ++nrewrite;
+      ExprRef idx = lower_soa_expr(index->index_, nrewrite);
+      std::vector<ExprRef> comps;
+      for (int32_t i = 0; i < soa_component_count(index->alloc_); ++i) {
+        comps.emplace_back(soa_component(index->alloc_, idx, i));
+      }
+      return TiVectorExpr::create(VectorExpr::create(std::move(comps)));
+    }
+  }
+  return map_expr(expr, [&](const ExprRef& x) { return lower_soa_expr(x, nrewrite); });
+}
+bool reads_ndarray(const ExprRef& expr, const std::string& arg_name) {
+  const NdArrayAllocExpr* alloc = dynamic_cast<const NdArrayAllocExpr*>(expr.get());
+  if (alloc != nullptr && alloc->arg_name_ == arg_name) {
+    return true;
+  }
+  bool out = false;
+  expr->for_each_child([&](const ExprRef& x) { out = out || reads_ndarray(x, arg_name); });
+  return out;
+}
+// Component `i` of a stored vector value.
+ExprRef vector_component(const ExprRef& value, int32_t i) {
+  const VectorExpr* vec = dynamic_cast<const VectorExpr*>(value.get());
+  if (const TiVectorExpr* vec2 = dynamic_cast<const TiVectorExpr*>(value.get())) {
+    vec = dynamic_cast<const VectorExpr*>(vec2->elems_.get());
+  }
+  if (vec != nullptr) {
+    return vec->elems_.at(i);
+  }
+  return IndexExpr::create(value, IntImmExpr::create(i));
+}
+
+uint32_t lower_soa(std::vector<StmtRef>& stmts, uint32_t& ntmp) {
+  uint32_t nrewrite = 0;
+  ExprMapper lower = [&](const ExprRef& x) { return lower_soa_expr(x, nrewrite); };
+
+  std::vector<StmtRef> out;
+  for (const StmtRef& stmt : stmts) {
+    if (const StoreStmt* store = dynamic_cast<const StoreStmt*>(stmt.get())) {
+      const IndexExpr* dst = dynamic_cast<const IndexExpr*>(store->dst_.get());
+      // Split vector stores into a store per component.
+      if (dst != nullptr && as_soa_alloc(dst->alloc_) != nullptr) {
+        ++nrewrite;
+        ExprRef idx = lower(dst->index_);
+        ExprRef value = lower(store->value_);
+        // Components are stored one by one, so read the whole value first if
+        // it's read from the destination.
+        if (reads_ndarray(value, as_soa_alloc(dst->alloc_)->arg_name_)) {
+          if (dynamic_cast<const VectorExpr*>(value.get()) != nullptr) {
+            value = TiVectorExpr::create(value);
+          }
+          ExprRef tmp = LocalVarExpr::create("soa_" + std::to_string(ntmp++), true);
+          out.emplace_back(DeclareStmt::create(tmp, value));
+          value = tmp;
+        }
+        for (int32_t i = 0; i < soa_component_count(dst->alloc_); ++i) {
+          out.emplace_back(StoreStmt::create(
+            soa_component(dst->alloc_, idx, i), vector_component(value, i)));
+        }
+        continue;
+      }
+    } else if (ForStmt* for_stmt = dynamic_cast<ForStmt*>(stmt.get())) {
+      // Loop over the spatial dimensions.
+      if (as_soa_alloc(for_stmt->range_) != nullptr) {
+        ++nrewrite;
+        const NdArrayAllocExpr* alloc = as_soa_alloc(for_stmt->range_);
+        std::vector<ExprRef> extents;
+        for (uint32_t i = 1; i < alloc->ndarray_.shape.dim_count; ++i) {
+          extents.emplace_back(NdArrayShapeExpr::create(for_stmt->range_, i));
+        }
+        for_stmt->range_ = NdRangeExpr::create(std::move(extents));
+      }
+    }
+
+    // Component stores `arr[idx][i] = x` are lowered with other expressions.
+    stmt->map_exprs(lower);
+    for (std::vector<StmtRef>* block : stmt->blocks()) {
+      nrewrite += lower_soa(*block, ntmp);
+    }
+    out.emplace_back(stmt);
+  }
+  stmts = std::move(out);
+  return nrewrite;
+}
+
+uint32_t SoaLoweringPass::run(ParseResult& itm) {
+  uint32_t ntmp = 0;
+  return lower_soa(itm.stmts, ntmp);
+}
+
+
+
+uint32_t LoopConfigPass::run(ParseResult& itm) {
+  uint32_t nrewrite = 0;
+  for (const StmtRef& stmt : itm.stmts) {
+    if (ForStmt* for_stmt = dynamic_cast<ForStmt*>(stmt.get())) {
+      for_stmt->block_dim_ = block_dim;
+      ++nrewrite;
+    }
+  }
+  return nrewrite;
+}
+
+
+
+PassManager PassManager::create_default(const KernelConfig& cfg) {
+  PassManager out {};
+  out.add(SoaLoweringPass::create());
+  if (cfg.specialize_shapes) {
+    out.add(ShapeSpecializationPass::create());
+  }
+  out.add(ConstantFoldingPass::create())
+    .add(DeadStoreEliminationPass::create())
+    .add(LoopInvariantCodeMotionPass::create());
+  if (cfg.block_dim != 0) {
+    out.add(LoopConfigPass::create(cfg.block_dim));
+  }
+  return out;
+}
+
+std::vector<PassStats> PassManager::run(ParseResult& itm) const {
+  std::vector<PassStats> out;
+  for (const PassRef& pass : passes) {
+    PassStats stats {};
+    stats.name = pass->name();
+    stats.nrewrite = pass->run(itm);
+    out.emplace_back(std::move(stats));
+  }
+  return out;
+}
+
+void print_pass_stats(const std::vector<PassStats>& stats) {
+  const char* enabled = std::getenv("TICPP_PRINT_PASS_STATS");
+  if (enabled == nullptr || std::string(enabled) == "0") { return; }
+
+  // Written at once so that concurrent instantiations don't interleave.
+  std::stringstream ss;
+  for (const PassStats& x : stats) {
+    ss << "[ticpp] " << x.name << ": " << x.nrewrite << " rewrite(s)" << std::endl;
+  }
+  std::cout << ss.str() << std::flush;
+}
+
+} // namespace ticpp
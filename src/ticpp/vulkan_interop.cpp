@@ -0,0 +1,84 @@
+#include <iomanip>
+#include "ticpp/vulkan_interop.hpp"
+
+namespace ticpp {
+
+#ifdef TI_WITH_VULKAN
+
+struct VulkanEventQuery {
+  TiRuntime runtime;
+  VkDevice device;
+  PFN_vkGetEventStatus get_event_status;
+};
+
+static bool export_vulkan_runtime(
+  TiArch arch,
+  TiRuntime runtime,
+  TiVulkanRuntimeInteropInfo& info
+) {
+  if (arch != TI_ARCH_VULKAN || runtime == nullptr) { return false; }
+  info = {};
+  ti_export_vulkan_runtime(runtime, &info);
+  return info.get_instance_proc_addr != nullptr;
+}
+
+bool get_vulkan_device_name(TiArch arch, TiRuntime runtime, std::string& name) {
+  TiVulkanRuntimeInteropInfo info;
+  if (!export_vulkan_runtime(arch, runtime, info)) { return false; }
+
+  PFN_vkGetPhysicalDeviceProperties get_physical_device_properties =
+    (PFN_vkGetPhysicalDeviceProperties)info.get_instance_proc_addr(
+      info.instance, "vkGetPhysicalDeviceProperties");
+  if (get_physical_device_properties == nullptr) { return false; }
+
+  VkPhysicalDeviceProperties props {};
+  get_physical_device_properties(info.physical_device, &props);
+
+  std::stringstream ss;
+  ss << props.deviceName << " " << std::hex << std::setfill('0')
+    << std::setw(4) << props.vendorID << ":" << std::setw(4) << props.deviceID;
+  name = ss.str();
+  return true;
+}
+
+VulkanEventQueryRef create_vulkan_event_query(TiArch arch, TiRuntime runtime) {
+  TiVulkanRuntimeInteropInfo info;
+  if (!export_vulkan_runtime(arch, runtime, info)) { return nullptr; }
+
+  PFN_vkGetDeviceProcAddr get_device_proc_addr =
+    (PFN_vkGetDeviceProcAddr)info.get_instance_proc_addr(
+      info.instance, "vkGetDeviceProcAddr");
+  if (get_device_proc_addr == nullptr) { return nullptr; }
+
+  VulkanEventQueryRef out = std::make_shared<VulkanEventQuery>();
+  out->runtime = runtime;
+  out->device = info.device;
+  out->get_event_status = (PFN_vkGetEventStatus)get_device_proc_addr(
+    info.device, "vkGetEventStatus");
+  if (out->get_event_status == nullptr) { return nullptr; }
+  return out;
+}
+
+bool is_vulkan_event_set(const VulkanEventQuery& query, TiEvent event) {
+  TiVulkanEventInteropInfo info {};
+  ti_export_vulkan_event(query.runtime, event, &info);
+  return query.get_event_status(query.device, info.event) == VK_EVENT_SET;
+}
+
+#else // TI_WITH_VULKAN
+
+struct VulkanEventQuery {};
+
+bool get_vulkan_device_name(TiArch arch, TiRuntime runtime, std::string& name) {
+  return false;
+}
+VulkanEventQueryRef create_vulkan_event_query(TiArch arch, TiRuntime runtime) {
+  return nullptr;
+}
+bool is_vulkan_event_set(const VulkanEventQuery& query, TiEvent event) {
+  return false;
+}
+
+#endif // TI_WITH_VULKAN
+
+} // namespace ticpp
@@ -0,0 +1,35 @@
+// Build-time AOT bundler. Traces every kernel registered with
+// `TICPP_REGISTER_KERNEL` and compiles them into one AOT module.
+// @PENGUINLIONG
+#include <cstring>
+#include "ticpp/aot_bundle.hpp"
+
+TiArch str2arch(const std::string& arch) {
+  if (arch == "vulkan") {
+    return TI_ARCH_VULKAN;
+  } else if (arch == "x64") {
+    return TI_ARCH_X64;
+  }
+  throw std::runtime_error("unsupported arch: " + arch);
+}
+
+int main(int argc, const char** argv) {
+  TiArch arch = TI_ARCH_VULKAN;
+  std::string module_dir = "module";
+
+  for (int i = 1; i < argc; ++i) {
+    if (std::strncmp(argv[i], "--arch=", 7) == 0) {
+      arch = str2arch(argv[i] + 7);
+    } else if (std::strncmp(argv[i], "--output=", 9) == 0) {
+      module_dir = argv[i] + 9;
+    } else {
+      std::cerr << "usage: " << argv[0] << " [--arch=vulkan|x64] [--output=<dir>]" << std::endl;
+      return -1;
+    }
+  }
+
+  ticpp::compile_aot_bundle(arch, module_dir);
+  std::cout << "compiled " << ticpp::get_registered_kernels().size()
+    << " kernel(s) into " << module_dir << std::endl;
+  return 0;
+}